@@ -12,9 +12,21 @@
 
 #define SUMMARIZERD_PORT      9872
 #define SUMMARIZERD_PROTO     0x1421
-#define SUMMARIZERD_VERSION   0x1
+#define SUMMARIZERD_VERSION_FILE    0x1 /* document named by a path */
+#define SUMMARIZERD_VERSION_INLINE  0x2 /* document sent in the request */
+#define SUMMARIZERD_VERSION_TAGGED  0x3 /* as 2, with ids to pipeline requests */
+#define SUMMARIZERD_VERSION_BATCH   0x4 /* as 3, with many documents */
+#define SUMMARIZERD_VERSION_RANKED  0x5 /* as 3, with many ratios, ranking */
+#define SUMMARIZERD_VERSION   SUMMARIZERD_VERSION_TAGGED
 
 #define MAX_FILENAME_LEN      256
+#define MAX_DOCUMENT_LEN      (16 << 20)
+#define MAX_BATCH_LEN         (64 << 20)
+#define MAX_BATCH_ITEMS       4096
+#define BATCH_INDEX_ALL       0xffffffff /* reply about the batch as a whole */
+#define MAX_RANKED_RATIOS     16
+#define RANKED_WITH_RANKING   0x1 /* flag: reply with the ranking too */
+#define RANKED_WITH_TERMS     0x2 /* flag: reply with the word stems too */
 
 /* TYPES */
 
@@ -28,7 +40,7 @@ typedef struct {
     uint16_t           proto;
     uint16_t           ver;
     uint32_t           ratio;
-    uint32_t           filename_len;
+    uint32_t           payload_len; /* filename or document, by version */
 } request_header_t;
 
 typedef struct {
@@ -44,4 +56,71 @@ typedef struct {
     uint32_t           status;
 } error_header_t;
 
+/* version 3 request header is followed by the id, its replies carry it */
+
+typedef struct {
+    uint16_t           proto;
+    uint16_t           ver;
+    uint32_t           status;
+    uint32_t           id;
+    uint32_t           summary_len;
+} tagged_response_header_t;
+
+typedef struct {
+    uint16_t           proto;
+    uint16_t           ver;
+    uint32_t           status;
+    uint32_t           id;
+} tagged_error_header_t;
+
+/* version 4 request payload is a count and that many items of
+   ratio[4] | document_len[4] | document[document_len], each replied to
+   on its own with the batch's id and the item's index */
+
+typedef struct {
+    uint32_t           ratio;
+    uint32_t           document_len;
+} batch_item_header_t;
+
+typedef struct {
+    uint16_t           proto;
+    uint16_t           ver;
+    uint32_t           status;
+    uint32_t           id;
+    uint32_t           index;
+    uint32_t           summary_len;
+} batch_response_header_t;
+
+typedef struct {
+    uint16_t           proto;
+    uint16_t           ver;
+    uint32_t           status;
+    uint32_t           id;
+    uint32_t           index;
+} batch_error_header_t;
+
+/* version 5 request payload is flags[4] | num_ratios[4] |
+   ratio[4] * num_ratios | document; the document is ranked once, each
+   ratio's summary is replied to with the request's id and the ratio's
+   index, then, if flagged, the ranking with index num_ratios: every
+   sentence, best first, as a ranked_sentence_t; with RANKED_WITH_TERMS
+   the ratios are followed by max_terms[4], 0 for all, and the stems are
+   replied to with index num_ratios + 1: most occurring first, each as a
+   ranked_term_t then its stem_len bytes */
+
+typedef struct {
+    uint32_t           flags;
+    uint32_t           num_ratios;
+} ranked_header_t;
+
+typedef struct {
+    uint32_t           sentence; /* index in the document */
+    uint32_t           num_words;
+} ranked_sentence_t;
+
+typedef struct {
+    uint32_t           num_occ;
+    uint32_t           stem_len;
+} ranked_term_t;
+
 #endif /* SUMMARIZER_DAEMON_H */
@@ -7,27 +7,72 @@
 #include <string.h>
 #include <unistd.h>
 #include <inttypes.h>
+#include <fcntl.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include "daemon.h"
 
+static int send_all(int sockfd, const void* buf, size_t len)
+{
+    ssize_t n;
+
+    while (len > 0) {
+        if ((n = send(sockfd, buf, len, 0)) < 0)
+            return -1;
+        buf = (const char*)buf + n;
+        len -= n;
+    }
+    return 0;
+}
+
 int main(int argc, char *argv[])
 {
-    int sockfd, n;
+    int sockfd, fd, n, ver = SUMMARIZERD_VERSION;
     float r;
     struct sockaddr_in serv_addr;
+    struct stat st;
     request_header_t req;
     error_header_t rep;
-    uint32_t summary_len;
+    uint32_t summary_len, id = 1;
     char buffer[256];
+    const char *payload;
+    size_t payload_len;
 
     if (argc < 3) {
-        fprintf(stderr,"usage %s file ratio\n", argv[0]);
+        fprintf(stderr,"usage %s file ratio [version]\n", argv[0]);
+        fprintf(stderr,"  version 1 sends the file name, 2 the file content, 3 the file\n"
+                       "  content with a request id [3]\n");
         exit(0);
     }
 
+    if (argc > 3)
+        ver = atoi(argv[3]);
+
+    if (SUMMARIZERD_VERSION_FILE == ver) {
+        payload = argv[1];
+        payload_len = strlen(argv[1]) + 1;
+    } else {
+        fd = open(argv[1], O_RDONLY);
+        if (fd < 0 || fstat(fd, &st) < 0)
+        {
+            perror("ERROR opening file");
+            exit(1);
+        }
+        payload_len = st.st_size;
+        payload = payload_len ?
+            mmap(NULL, payload_len, PROT_READ, MAP_PRIVATE, fd, 0) : "";
+        if (payload == MAP_FAILED)
+        {
+            perror("ERROR mapping file");
+            exit(1);
+        }
+        close(fd);
+    }
+
     /* Create a socket point */
     sockfd = socket(AF_INET, SOCK_STREAM, 0);
     if (sockfd < 0)
@@ -50,21 +95,31 @@ int main(int argc, char *argv[])
     }
 
     req.proto = htons(SUMMARIZERD_PROTO);
-    req.ver = htons(SUMMARIZERD_VERSION);
+    req.ver = htons(ver);
     r = atof(argv[2]);
     req.ratio = *((uint32_t*)(void*)&r);
     req.ratio = htonl(req.ratio);
-    req.filename_len = htonl(strlen(argv[1]) + 1);
+    req.payload_len = htonl(payload_len);
 
     /* Send message to the server */
-    n = send(sockfd,&req,sizeof(req),0);
+    n = send_all(sockfd,&req,sizeof(req));
     if (n < 0)
     {
         perror("ERROR writing to socket");
         close(sockfd);
         exit(1);
     }
-    n = send(sockfd,argv[1],strlen(argv[1])+1,0);
+    if (SUMMARIZERD_VERSION_TAGGED == ver) {
+        id = htonl(id);
+        n = send_all(sockfd,&id,sizeof(id));
+        if (n < 0)
+        {
+            perror("ERROR writing to socket");
+            close(sockfd);
+            exit(1);
+        }
+    }
+    n = send_all(sockfd,payload,payload_len);
     if (n < 0)
     {
         perror("ERROR writing to socket");
@@ -82,8 +137,20 @@ int main(int argc, char *argv[])
     rep.proto = ntohs(rep.proto);
     rep.ver = ntohs(rep.ver);
     rep.status = ntohl(rep.status);
-    printf("response header - proto %x ver %x status %u\n",
-           rep.proto, rep.ver, rep.status);
+    if (SUMMARIZERD_VERSION_TAGGED == rep.ver) {
+        n = recv(sockfd,&id,sizeof(id),0);
+        if (n < 0)
+        {
+            perror("ERROR reading from socket");
+            close(sockfd);
+            exit(1);
+        }
+        printf("response header - proto %x ver %x status %u id %u\n",
+               rep.proto, rep.ver, rep.status, ntohl(id));
+    } else {
+        printf("response header - proto %x ver %x status %u\n",
+               rep.proto, rep.ver, rep.status);
+    }
 
     if(REP_SUMMARY == rep.status) {
         n = recv(sockfd,&summary_len,sizeof(uint32_t),0);
@@ -96,8 +163,8 @@ int main(int argc, char *argv[])
         summary_len = ntohl(summary_len);
         printf("Receiving summary of %u bytes", summary_len);
         while(summary_len > 0) {
-            n = recv(sockfd,buffer,256,0);
-            if (n < 0)
+            n = recv(sockfd,buffer,sizeof(buffer)-1,0);
+            if (n <= 0)
             {
                 perror("ERROR reading from socket");
                 close(sockfd);
@@ -0,0 +1,217 @@
+/*
+ * eolbench.c
+ */
+
+#include "header.h"
+
+/* MACROS */
+
+#define PASSES_DEFAULT      200
+#define DIFFS_SHOWN         10
+
+#define NSECS(t1, t2) \
+    (((t2).tv_sec - (t1).tv_sec) * 1e9 + ((t2).tv_usec - (t1).tv_usec) * 1e3)
+
+/* TYPEDEFS */
+
+typedef struct span_s span_t;
+
+struct span_s {
+    charpos_t           word;
+    size_t              len;
+};
+
+/* FUNCTIONS */
+
+static void usage(const char* prog);
+static status_t load_raw_rules(const char* xml_name, lang_t* raw);
+static bool_t end_of_line_scan(const lang_t* raw, const char* word, size_t len);
+static bool_t match_at_end(const char* word, size_t len, const char* rule);
+
+int
+main(int argc, char** argv)
+{
+    lang_t          lang, raw;
+    stream_t        stream;
+    array_t       * spans = NULL;
+    span_t        * span, * first;
+    struct timeval  t1, t2, t3;
+    status_t        status;
+    bool_t          is_line_end, is_break;
+    int             opt;
+    literal_t       xml_name = DICTIONARY_DIR"/en.xml";
+    size_t          num_passes = PASSES_DEFAULT, num_spans = 0, num_breaks = 0;
+    size_t          num_diffs = 0, pass, i, count = 0, scan_count = 0;
+
+    while(-1 != (opt = getopt(argc, argv, "d:n:h"))) {
+        switch(opt) {
+            case 'd': xml_name = optarg; break;
+            case 'n': num_passes = atol(optarg); break;
+            case 'h': usage(argv[0]); return(0);
+            default: usage(argv[0]); return(1);
+        }
+    }
+
+    if(optind + 1 != argc || 0 == num_passes) {
+        usage(argv[0]);
+        return(1);
+    }
+
+    memset(&stream, 0, sizeof(stream_t));
+
+    status =
+        init_globals() ||
+
+        lang_init(&lang) ||
+
+        parse_lang_xml(xml_name, &lang) ||
+
+        lang_init(&raw) ||
+
+        load_raw_rules(xml_name, &raw) ||
+
+        stream_create(argv[optind], &stream, SMRZR_FALSE) ||
+
+        (NULL == (spans = array_new(SMRZR_TRUE, sizeof(span_t),
+                                    ARRAY_DEFAULT_SZ, NULL)));
+
+    /* words as articles are split into them */
+    while(SMRZR_OK == status && !STREAM_END(&stream)) {
+
+        STREAM_FIND_WORD(&stream);
+
+        if(STREAM_END(&stream)) break;
+
+        if(NULL == (span = (span_t*)array_alloc(&spans))) {
+            status = SMRZR_ERROR;
+            break;
+        }
+
+        STREAM_GET_WORD(&stream, span->word, span->len, is_line_end);
+    }
+
+    if(SMRZR_OK == status) {
+
+        first = (span_t*)ARR_AT(spans, 0);
+        num_spans = ARR_SZ(spans);
+
+        /* the compiled rules decide as the rules listed in the xml did */
+        for(i = 0, span = first; i < num_spans; ++i, ++span) {
+
+            is_break = end_of_line(&lang, span->word, span->len);
+
+            if(is_break != end_of_line_scan(&raw, span->word, span->len)) {
+                if(DIFFS_SHOWN > num_diffs++)
+                    fprintf(stderr, "word %lu '%.*s': %s, the rules say %s\n",
+                            i + 1, (int)span->len, span->word,
+                            is_break ? "break" : "no break",
+                            is_break ? "no break" : "break");
+            }
+
+            if(SMRZR_TRUE == is_break) ++num_breaks;
+        }
+
+        gettimeofday(&t1, NULL);
+
+        for(pass = 0; pass < num_passes; ++pass)
+            for(i = 0, span = first; i < num_spans; ++i, ++span)
+                count += end_of_line(&lang, span->word, span->len);
+
+        gettimeofday(&t2, NULL);
+
+        for(pass = 0; pass < num_passes; ++pass)
+            for(i = 0, span = first; i < num_spans; ++i, ++span)
+                scan_count += end_of_line_scan(&raw, span->word, span->len);
+
+        gettimeofday(&t3, NULL);
+
+        fprintf(stdout, "%s: %lu words, %lu sentence ends\n",
+                argv[optind], num_spans, num_breaks);
+
+        fprintf(stdout, "end_of_line: %.1f ns per word, %lu breaks in %lu passes\n",
+                NSECS(t1, t2) / (num_passes * num_spans), count, num_passes);
+        fprintf(stdout, "rules one by one: %.1f ns per word, %lu breaks\n",
+                NSECS(t2, t3) / (num_passes * num_spans), scan_count);
+
+        if(0 != num_diffs)
+            fprintf(stderr, "%lu words broken differently\n", num_diffs);
+    }
+
+    array_free(spans);
+
+    stream_destroy(&stream);
+
+    lang_destroy(&raw);
+
+    lang_destroy(&lang);
+
+    return(SMRZR_OK == status && 0 == num_diffs ? 0 : 1);
+}
+
+void usage(const char* prog)
+{
+    fprintf(stderr, "Usage: %s [-d <dictionary-xml>] [-n <passes>] <input-file>\n", prog);
+    fprintf(stderr, "Usage: %s -h\n\n", prog);
+    fprintf(stderr, "dictionary-xml : the language rules [%s]\n",
+            DICTIONARY_DIR"/en.xml");
+    fprintf(stderr, "        passes : over the words of the input, timed [%d]\n",
+            PASSES_DEFAULT);
+    fprintf(stderr, "    input-file : split into words as articles are; fails if\n"
+                    "                 any word ends a sentence other than by the\n"
+                    "                 rules tried one by one\n");
+    fprintf(stderr, "            -h : print this help\n");
+}
+
+status_t
+load_raw_rules(const char* xml_name, lang_t* raw)
+{
+    string_t tag;
+
+    /* only the parser rules, kept as strings in the xml */
+    if(SMRZR_OK != stream_create(xml_name, &raw->stream, SMRZR_TRUE))
+        ERROR_RET;
+
+    while(NULL != (tag = get_xml_tag(&raw->stream))) {
+        if(!strcmp("parser", tag))
+            return(parse_parser_xml(raw));
+    }
+
+    fprintf(stderr, "No 'parser' node in '%s'\n", xml_name);
+    ERROR_RET;
+}
+
+bool_t
+end_of_line_scan(const lang_t* raw, const char* word, size_t len)
+{
+    string_t   * r;
+    array_t    * a;
+
+    /* as end_of_line was: some line_break rule, then no line_dont_break
+       rule, matching a strict tail of the word */
+    a = raw->line_break;
+
+    for(r = (string_t*)ARR_FIRST(a); !ARR_END(a); r = (string_t*)ARR_NEXT(a)) {
+        if(match_at_end(word, len, *r)) break;
+    }
+
+    if(ARR_END(a)) return(SMRZR_FALSE);
+
+    a = raw->line_dont_break;
+
+    for(r = (string_t*)ARR_FIRST(a); !ARR_END(a); r = (string_t*)ARR_NEXT(a)) {
+        if(match_at_end(word, len, *r)) return(SMRZR_FALSE);
+    }
+
+    return(SMRZR_TRUE);
+}
+
+bool_t
+match_at_end(const char* word, size_t len, const char* rule)
+{
+    size_t rule_len = strlen(rule);
+
+    if(rule_len >= len || strncasecmp(word + len - rule_len, rule, rule_len))
+        return(SMRZR_FALSE);
+
+    return(SMRZR_TRUE);
+}
@@ -19,7 +19,11 @@
 #include <unistd.h>
 #include <sys/time.h>
 #include <ctype.h>
+#include <limits.h>
 #include <assert.h>
+#if defined __SSE2__
+#include <emmintrin.h>
+#endif
 
 /* MACROS */
 
@@ -71,26 +75,27 @@ do { \
 
 #define SPACE   " \t\n\r\v\f"
 
+/* articles are only read: words are spans of the stream, between spaces
+   (and nulls, which aren't text) */
+#define IS_SPACE(c) \
+    (' ' == (c) || ('\t' <= (c) && '\r' >= (c)) || 0 == (c))
+
 #define STREAM_FIND(s, c)  \
     (s)->curr = strchr((s)->curr, c)
 
 #define STREAM_TOKEN(s, c) \
     (strsep(&(s)->curr, c))
 
+/* spans are found 16 bytes at a time where SSE2 is there, see lib.c */
 #define STREAM_FIND_WORD(s) \
-    (s)->curr += strspn((s)->curr, SPACE)
+    ((s)->curr = stream_skip_space((s)->curr, (s)->begin + (s)->len, NULL))
 
-#define STREAM_GET_WORD(s, w, f) \
+#define STREAM_GET_WORD(s, w, wl, f) \
 do { \
-    charpos_t end; \
+    charpos_t word_end; \
     w = (s)->curr; \
-    (s)->curr += strcspn((s)->curr, SPACE); \
-    end = (s)->curr; \
-    STREAM_FIND_WORD(s); \
-    while(end != (s)->curr) { \
-        if(*end == '\n' || *end == '\r') f = SMRZR_TRUE; \
-        *end = 0; ++end; \
-    } \
+    (s)->curr = stream_next_word(w, (s)->begin + (s)->len, &word_end, &(f)); \
+    wl = word_end - w; \
 } while(0)
 
 #define STREAM_END(s) \
@@ -100,6 +105,14 @@ do { \
 
 #define ARRAY_DEFAULT_SZ     16384
 
+/* stack of strings in chunks */
+
+#define ARENA_CHUNK_SZ       (64UL << 10)
+#define ARENA_HUGE_CHUNK_SZ  (2UL << 20)
+
+#define CHUNK_DATA(c) \
+  (PTR_ADD(char*, c, sizeof(chunk_t)))
+
 #define ARR_FULL(a, sz)    \
   ((SMRZR_TRUE == (a)->is_array && \
       (((ptr_t)((a)->curr) + (a)->elem_sz - ((ptr_t)a)) > (a)->array_sz)) || \
@@ -124,6 +137,55 @@ do { \
 #define ARR_LAST(a) \
   (PTR_ADD(elem_t, a->curr, -(a->elem_sz)))
 
+#define ARR_INDEX(a, e) \
+  (PTR_DIFF(e, PTR_ADD(elem_t, a, sizeof(array_t))) / a->elem_sz)
+
+#define ARR_AT(a, i) \
+  (PTR_ADD(elem_t, a, sizeof(array_t) + (i) * a->elem_sz))
+
+/* hash index over array elements */
+
+#define HASH_DEFAULT_SLOTS   1024
+
+#define HASH_SLOTS(h) \
+  (PTR_ADD(slot_t*, h, sizeof(hash_t)))
+
+#define HASH_FULL(h) \
+  (4 * ((h)->num_used + 1) > 3 * (h)->num_slots)
+
+/* compiled rules */
+
+#define TRIE_VALUES(t) \
+  (PTR_ADD(uint32_t*, t, sizeof(trie_t)))
+
+#define TRIE_NEXT(t) \
+  (PTR_ADD(uint16_t*, t, sizeof(trie_t) + (t)->num_nodes * sizeof(uint32_t)))
+
+#define TRIE_SZ(t) \
+  (sizeof(trie_t) + (t)->num_nodes * \
+   (sizeof(uint32_t) + (t)->num_classes * sizeof(uint16_t)))
+
+#define TRIE_MAX_NODES       65535
+
+#define RULE_FROM(r) \
+  (PTR_ADD(literal_t, r, (r)->from))
+
+#define RULE_TO(r) \
+  (PTR_ADD(literal_t, r, (r)->to))
+
+#define EOL_BREAK            0x1
+#define EOL_DONT_BREAK       0x2
+
+/* compiled dictionary image */
+
+#define DICT_MAGIC           0x445a4d53 /* "SMZD" */
+#define DICT_VERSION         1
+#define DICT_SUFFIX          ".dict"
+#define DICT_XML_SUFFIX      ".xml"
+
+#define DICT_ALIGN(sz) \
+  (((sz) + 7) & ~(size_t)7)
+
 /* lang info parsing */
 
 #define XML_TAG_BEGIN_CHAR   '<'
@@ -134,11 +196,6 @@ do { \
 #define XML_TAG_END_STR      ">"
 #define RULE_SEPARATOR_STR   "|"
 
-/* article parsing */
-
-#define MATCH_AT_END(w, e, wl, el) (el < wl && !strcasecmp(w + wl - el, e))
-#define MATCH_AT_BEG(w, b, wl, bl) (bl < wl && !strncasecmp(w, b, bl))
-
 
 /* TYPEDEFS */
 
@@ -151,13 +208,27 @@ typedef intptr_t     ptr_t;
 typedef enum status_e   status_t;
 typedef enum bool_e     bool_t;
 typedef enum relation_e relation_t;
+typedef enum ruletype_e ruletype_t;
+typedef enum dictsetid_e dictsetid_t;
 
 typedef struct stream_s stream_t;
 
 typedef struct array_s array_t;
 
+typedef struct chunk_s chunk_t;
+typedef struct arena_s arena_t;
+
+typedef struct slot_s slot_t;
+typedef struct hash_s hash_t;
+
+typedef struct rule_s    rule_t;
+typedef struct trie_s    trie_t;
+typedef struct ruleset_s ruleset_t;
+typedef struct dictset_s dictset_t;
+typedef struct dict_s    dict_t;
+
 typedef struct sentence_s sentence_t;
-typedef struct word_s     word_t;
+typedef struct scored_s   scored_t;
 typedef struct lang_s     lang_t;
 typedef struct article_s  article_t;
 
@@ -183,6 +254,26 @@ enum relation_e {
     SMRZR_GT = 1
 };
 
+enum ruletype_e {
+    RULE_HEAD = 0,
+    RULE_TAIL,
+    RULE_WORD,
+    RULE_KEY,  /* whole words without replacement */
+    RULE_MARK  /* tails without replacement, flagged by source list */
+};
+
+enum dictsetid_e {
+    DICT_PRE1 = 0,
+    DICT_POST1,
+    DICT_MANUAL,
+    DICT_SYNONYMS,
+    DICT_PRE,
+    DICT_POST,
+    DICT_EXCLUDE,
+    DICT_EOL,
+    DICT_NUM_SETS
+};
+
 /* STRUCTS */
 
 /* In memory region */
@@ -206,23 +297,104 @@ struct array_s {
     elem_t              iter;
 };
 
+/* Pushed and popped last first like a stack, but grown a chunk at a time
+   so what is pushed stays where it is; chunks emptied by a pop or reset are
+   kept to be reused. Data follows the chunk header. */
+
+struct chunk_s {
+    chunk_t           * next; /* the older one in use, or the next free one */
+    char              * curr;
+    char              * end;
+    size_t              map_len; /* mapped on huge pages if not 0 */
+};
+
+struct arena_s {
+    chunk_t           * chunks; /* in use, the newest first */
+    chunk_t           * free;
+    bool_t              is_huge;
+};
+
+/* Open-addressing index of array elements, slots follow the header */
+
+struct slot_s {
+    uint32_t            hash;
+    uint32_t            index; /* 1-based index into array; 0 = empty */
+};
+
+struct hash_s {
+    size_t              num_slots; /* power of 2 */
+    size_t              num_used;
+};
+
+/* Compiled dictionary rules; strings are at byte offsets from the rule itself
+   so that compiled tables stay valid wherever the image is mapped */
+
+struct rule_s {
+    uint32_t            from; /* lowercase, not null-terminated */
+    uint32_t            to;
+    uint32_t            from_len;
+    uint32_t            to_len;
+};
+
+/* Character trie over 'from' parts of rules, walked from the end of the word
+   for tail rules. Node values are 1-based rule indices, or OR'ed rule flags
+   when built with flags, 0 for none; the value and next-node tables follow
+   the header. */
+
+struct trie_s {
+    uint32_t            is_reversed;
+    uint32_t            num_nodes;
+    uint32_t            num_classes;
+    uint8_t             class_of[256]; /* case-folded; 0 = in no rule */
+};
+
+struct ruleset_s {
+    const rule_t      * rules; /* sorted on 'from' for RULE_WORD/RULE_KEY */
+    size_t              num_rules;
+    const trie_t      * trie;  /* NULL for RULE_WORD/RULE_KEY */
+    ruletype_t          type;
+    size_t              max_growth;
+};
+
+/* Compiled dictionary image, as built from the xml and as stored on disk;
+   everything is addressed by offsets from the header */
+
+struct dictset_s {
+    uint32_t            rules;
+    uint32_t            num_rules;
+    uint32_t            trie; /* 0 for none */
+    uint32_t            max_growth;
+};
+
+struct dict_s {
+    uint32_t            magic;
+    uint32_t            version;
+    uint32_t            size;
+    uint32_t            src_size; /* of the xml it was compiled from */
+    dictset_t           sets[DICT_NUM_SETS];
+};
+
 /* Document processing */
 
 struct sentence_s {
     charpos_t           begin;
     charpos_t           end;
     size_t              num_words;
+    uint32_t            first_token; /* into article tokens */
+    uint32_t            num_tokens;
     uint32_t            score;
     uint32_t            is_para_begin;
     uint32_t            is_selected;
-    elem_t              cookie;
 };
 
-struct word_s {
-    string_t            stem;
-    size_t              num_occ;
+struct scored_s {
+    uint32_t            score;
+    uint32_t            index; /* into article sentences or stems */
 };
 
+/* Read-only once parse_lang_xml returns, may be shared between threads.
+   The raw rule lists and stream are only used while compiling the xml. */
+
 struct lang_s {
     stream_t            stream;
     array_t           * pre1;
@@ -234,14 +406,31 @@ struct lang_s {
     array_t           * line_break;
     array_t           * line_dont_break;
     array_t           * exclude;
+    ruleset_t           pre1_set;
+    ruleset_t           post1_set;
+    ruleset_t           manual_set;
+    ruleset_t           synonyms_set;
+    ruleset_t           pre_set;
+    ruleset_t           post_set;
+    ruleset_t           exclude_set;
+    ruleset_t           eol_set; /* line_break and line_dont_break */
+    dict_t            * dict;
+    size_t              dict_map_len;
 };
 
 struct article_s {
     stream_t            stream;
     size_t              num_words;
     array_t           * sentences;
-    array_t           * words;
-    array_t           * stack;
+    array_t           * stems; /* interned, a word's id is its index */
+    array_t           * counts; /* uint32 occurrences, by word id */
+    array_t           * weights; /* uint32 score per occurrence, by word id */
+    hash_t            * word_index;
+    array_t           * tokens; /* word ids of all sentences */
+    array_t           * ranking; /* sentence indices, best first */
+    array_t           * terms; /* word ids, most occurring first */
+    arena_t             stack; /* words as they are changed, and stems */
+    string_t            owned_buf; /* parsed in place, freed with the article */
 };
 
 
@@ -249,10 +438,18 @@ struct article_s {
 
 /* file stream */
 
-status_t stream_create(const char* file_name, stream_t* stream);
+status_t stream_create(const char* file_name, stream_t* stream,
+                       bool_t is_writable);
+
+status_t stream_from_buffer(stream_t* stream, const char* buf, size_t len);
 
 void     stream_destroy(stream_t* stream);
 
+charpos_t stream_skip_space(charpos_t p, charpos_t end, bool_t* is_line_end);
+
+charpos_t stream_next_word(charpos_t word, charpos_t end, charpos_t* word_end,
+                           bool_t* is_line_end);
+
 /* efficient list and lookup */
 
 array_t* array_new(uint32_t is_array, size_t elem_sz, size_t num_elems, array_t*
@@ -266,9 +463,6 @@ status_t array_add_elemptr(array_t** array, elem_t elem);
 
 elem_t   array_alloc(array_t** array);
 
-elem_t   array_push_alloc(array_t** array, size_t sz);
-
-void     array_pop_free(array_t* array, elem_t);
 
 elem_t   array_sorted_alloc(array_t** array, const elem_t key, compfunc_t cf);
 
@@ -278,6 +472,30 @@ elem_t   array_search_or_alloc(array_t** array, const elem_t key, compfunc_t cf,
 
 void     array_remove(array_t* array, const elem_t key, compfunc_t cf);
 
+void     arena_init(arena_t* arena, bool_t is_huge);
+
+void     arena_destroy(arena_t* arena);
+
+void     arena_reset(arena_t* arena);
+
+elem_t   arena_push_alloc(arena_t* arena, size_t sz);
+
+void     arena_pop_free(arena_t* arena, elem_t elem);
+
+hash_t*  hash_new(size_t num_slots, hash_t* orig);
+
+void     hash_free(hash_t* hash);
+
+void     hash_reset(hash_t* hash);
+
+uint32_t hash_string(const char* s);
+
+elem_t   hash_search(const hash_t* hash, const array_t* array, const elem_t key,
+                     uint32_t hval, compfunc_t cf);
+
+elem_t   hash_search_or_alloc(hash_t** hash, array_t** array, const elem_t key,
+                              uint32_t hval, compfunc_t cf, bool_t* is_new);
+
 /* lang info parsing */
 
 status_t lang_init(lang_t* lang);
@@ -286,12 +504,27 @@ void     lang_destroy(lang_t* lang);
 
 status_t parse_lang_xml(const char* file_name, lang_t* lang);
 
+status_t lang_load_xml(const char* file_name, lang_t* lang);
+
+status_t lang_load_dict(const char* file_name, const char* xml_name, lang_t* lang);
+
+status_t lang_save_dict(const lang_t* lang, const char* file_name);
+
+status_t lang_attach(lang_t* lang, dict_t* dict, size_t map_len);
+
 status_t parse_stemmer_xml(lang_t* lang);
 
 status_t parse_parser_xml(lang_t* lang);
 
 status_t parse_exclude_xml(lang_t* lang);
 
+status_t lang_compile(lang_t* lang);
+
+uint32_t dict_alloc(dict_t** dict, size_t sz);
+
+status_t dictset_compile(dict_t** dict, dictsetid_t id, array_t** raw,
+                         size_t num_raw, ruletype_t type);
+
 status_t parse_children_for_array(stream_t* stream, array_t** array, literal_t
 child_name);
 
@@ -301,40 +534,65 @@ string_t get_xml_tag(stream_t* stream);
 
 /* article parsing */
 
-status_t article_init(article_t* article);
+status_t article_init(article_t* article, bool_t is_huge);
 
 void     article_destroy(article_t* article);
 
 void     article_reset(article_t* article);
 
-status_t parse_article(const char* file_name, lang_t* lang, article_t* article);
+status_t parse_article(const char* file_name, const lang_t* lang, article_t* article);
+
+status_t parse_article_buffer(const char* buf, size_t len, const lang_t* lang,
+                              article_t* article); /* kept till summarized */
+
+status_t parse_article_stream(const lang_t* lang, article_t* article);
 
 sentence_t* sentence_new(array_t** array, charpos_t begin);
 
-string_t get_word_core(array_t** stack, lang_t* lang, const string_t word);
+string_t get_word_core(arena_t* stack, const lang_t* lang, const char* word,
+                       size_t len, bool_t* is_proper);
+
+string_t get_word_stem(arena_t* stack, const lang_t* lang, const string_t core,
+                       bool_t is_proper);
+
+relation_t comp_rule_with_word(const rule_t* rule, const char* word, size_t len);
+
+int      comp_raw_rules(const void* r1, const void* r2); /* char**, char** */
+
+relation_t comp_stems(const elem_t s1, const elem_t s2); /* char**, char* */
 
-string_t get_word_stem(array_t** stack, lang_t* lang, const string_t word, bool_t is_core);
+const rule_t* ruleset_find(const ruleset_t* set, const char* word, size_t len);
 
-relation_t comp_strings(const elem_t s1, const elem_t s2); /* char**, char* */
+size_t   ruleset_apply(const ruleset_t* set, string_t word, size_t len);
 
-relation_t comp_string_with_rule(const elem_t s1, const elem_t s2); /* char**, char* */
+trie_t*  trie_new(const rule_t* rules, size_t num_rules, const uint32_t* flags,
+                  bool_t is_reversed);
 
-relation_t comp_word_by_stem(const elem_t word_obj, const elem_t stem); /* word_t*, char* */
+void     trie_free(trie_t* trie);
 
-bool_t   replace_word_head(string_t word, string_t rule);
+uint32_t trie_match(const trie_t* trie, const char* word, size_t len);
 
-bool_t   replace_word_tail(string_t word, string_t rule);
+uint32_t trie_match_flags(const trie_t* trie, const char* word, size_t len);
 
-void     replace_word(array_t** stack, string_t word, string_t rule);
+size_t   rule_apply_head(string_t word, size_t len, const rule_t* rule);
 
-bool_t   end_of_line(lang_t* lang, string_t word);
+size_t   rule_apply_tail(string_t word, size_t len, const rule_t* rule);
+
+size_t   rule_apply_word(string_t word, size_t len, const rule_t* rule);
+
+bool_t   end_of_line(const lang_t* lang, const char* word, size_t len);
 
 /* article grading */
 
-status_t grade_article(article_t* article, lang_t* lang, float ratio);
+status_t grade_article(article_t* article, const lang_t* lang, float ratio);
+
+status_t rank_article(article_t* article, const lang_t* lang);
+
+void     select_sentences(article_t* article, float ratio);
+
+status_t rank_terms(article_t* article, size_t max_terms);
 
-relation_t comp_sentence_by_score(const elem_t sen_obj, const elem_t num_occ);
-/* sentence_t*, size_t */
+int      comp_scored(const void* s1, const void* s2); /* scored_t*, scored_t* */
 
 /* others */
 
@@ -67,16 +67,57 @@ lang_init(lang_t* lang)
                                        EXCLUDE_ELEM_ESTIMATE, NULL)))
         ERROR_RET;
 
+    memset(&lang->pre1_set, 0, sizeof(ruleset_t));
+    memset(&lang->post1_set, 0, sizeof(ruleset_t));
+    memset(&lang->manual_set, 0, sizeof(ruleset_t));
+    memset(&lang->synonyms_set, 0, sizeof(ruleset_t));
+    memset(&lang->pre_set, 0, sizeof(ruleset_t));
+    memset(&lang->post_set, 0, sizeof(ruleset_t));
+    memset(&lang->exclude_set, 0, sizeof(ruleset_t));
+    memset(&lang->eol_set, 0, sizeof(ruleset_t));
+
+    lang->dict = NULL;
+    lang->dict_map_len = 0;
+
     return(SMRZR_OK);
 }
 
 status_t
 parse_lang_xml(const char* file_name, lang_t* lang)
 {
-    string_t tag;
+    char        dict_name[PATH_MAX];
+    size_t      len = strlen(file_name);
+    status_t    status;
     PROF_START;
 
-    if(SMRZR_OK != stream_create(file_name, &lang->stream))
+    /* a compiled dictionary next to the xml is mapped as is, if up to date */
+    if(len > strlen(DICT_XML_SUFFIX) &&
+       len - strlen(DICT_XML_SUFFIX) + strlen(DICT_SUFFIX) < sizeof(dict_name) &&
+       !strcmp(file_name + len - strlen(DICT_XML_SUFFIX), DICT_XML_SUFFIX))
+    {
+        len -= strlen(DICT_XML_SUFFIX);
+        memcpy(dict_name, file_name, len);
+        strcpy(dict_name + len, DICT_SUFFIX);
+
+        if(SMRZR_OK == lang_load_dict(dict_name, file_name, lang)) {
+            PROF_END("lang info loading");
+            return(SMRZR_OK);
+        }
+    }
+
+    status = lang_load_xml(file_name, lang);
+
+    PROF_END("lang info xml parsing");
+    return(status);
+}
+
+status_t
+lang_load_xml(const char* file_name, lang_t* lang)
+{
+    string_t tag;
+
+    /* tags are cut in place */
+    if(SMRZR_OK != stream_create(file_name, &lang->stream, SMRZR_TRUE))
         ERROR_RET;
 
     if(NULL == get_xml_tag(&lang->stream)) /* ignore the first line */
@@ -97,18 +138,522 @@ parse_lang_xml(const char* file_name, lang_t* lang)
             if(SMRZR_OK != parse_exclude_xml(lang)) return SMRZR_ERROR;
         } else
         if(!strcmp("/dictionary", tag)) { /* done with xml doc */
-            PROF_END("lang info xml parsing");
-            return(SMRZR_OK);
+            break;
         } else {
             fprintf(stderr, "Invalid child '%s' of 'dictionary' node\n", tag);
             ERROR_RET;
         }
     }
 
-    PROF_END("lang info xml parsing");
+    if(SMRZR_OK != lang_compile(lang))
+        ERROR_RET;
+
+    return(SMRZR_OK);
+}
+
+status_t
+lang_load_dict(const char* file_name, const char* xml_name, lang_t* lang)
+{
+    struct stat st, xml_st;
+    dict_t    * dict;
+    int         fd;
+
+    /* a missing image is not an error, the xml is used instead */
+    if(0 > (fd = open(file_name, O_RDONLY)))
+        return(SMRZR_ERROR);
+
+    if(0 != fstat(fd, &st) || (size_t)st.st_size < sizeof(dict_t)) {
+        close(fd);
+        return(SMRZR_ERROR);
+    }
+
+    if(MAP_FAILED == (dict = (dict_t*)mmap(NULL, st.st_size, PROT_READ,
+                                           MAP_PRIVATE, fd, 0)))
+    {
+        close(fd);
+        return(SMRZR_ERROR);
+    }
+
+    close(fd);
+
+    /* stale if the xml was edited after the image was compiled */
+    if(NULL != xml_name && 0 == stat(xml_name, &xml_st) &&
+       ((size_t)xml_st.st_size != dict->src_size ||
+        xml_st.st_mtime > st.st_mtime))
+    {
+        fprintf(stderr, "Ignoring compiled dictionary '%s' older than '%s'\n",
+                file_name, xml_name);
+        munmap(dict, st.st_size);
+        return(SMRZR_ERROR);
+    }
+
+    if(SMRZR_OK != lang_attach(lang, dict, st.st_size)) {
+        fprintf(stderr, "Ignoring invalid compiled dictionary '%s'\n", file_name);
+        munmap(dict, st.st_size);
+        return(SMRZR_ERROR);
+    }
+
+    return(SMRZR_OK);
+}
+
+status_t
+lang_save_dict(const lang_t* lang, const char* file_name)
+{
+    char        tmp_name[PATH_MAX];
+    FILE      * fp;
+
+    if(NULL == lang->dict)
+        ERROR_RET;
+
+    /* replaced atomically, running processes keep their old mapping */
+    if(sizeof(tmp_name) <= (size_t)snprintf(tmp_name, sizeof(tmp_name),
+                                            "%s.tmp", file_name))
+        ERROR_RET;
+
+    if(NULL == (fp = fopen(tmp_name, "wb"))) {
+        perror("Error in creating compiled dictionary: ");
+        ERROR_RET;
+    }
+
+    if(1 != fwrite(lang->dict, lang->dict->size, 1, fp) || 0 != fclose(fp)) {
+        perror("Error in writing compiled dictionary: ");
+        unlink(tmp_name);
+        ERROR_RET;
+    }
+
+    if(0 != rename(tmp_name, file_name)) {
+        perror("Error in renaming compiled dictionary: ");
+        unlink(tmp_name);
+        ERROR_RET;
+    }
+
+    return(SMRZR_OK);
+}
+
+status_t
+lang_attach(lang_t* lang, dict_t* dict, size_t map_len)
+{
+    static const ruletype_t types[DICT_NUM_SETS] = {
+        RULE_HEAD, RULE_TAIL, RULE_WORD, RULE_WORD,
+        RULE_HEAD, RULE_TAIL, RULE_KEY, RULE_MARK
+    };
+    ruleset_t       * sets[DICT_NUM_SETS];
+    const dictset_t * ds;
+    const trie_t    * trie;
+    size_t            i;
+
+    sets[DICT_PRE1] = &lang->pre1_set;
+    sets[DICT_POST1] = &lang->post1_set;
+    sets[DICT_MANUAL] = &lang->manual_set;
+    sets[DICT_SYNONYMS] = &lang->synonyms_set;
+    sets[DICT_PRE] = &lang->pre_set;
+    sets[DICT_POST] = &lang->post_set;
+    sets[DICT_EXCLUDE] = &lang->exclude_set;
+    sets[DICT_EOL] = &lang->eol_set;
+
+    if(DICT_MAGIC != dict->magic || DICT_VERSION != dict->version ||
+       dict->size > map_len)
+        return(SMRZR_ERROR);
+
+    /* only bounds are checked, the image itself is trusted */
+    for(i = 0; i < DICT_NUM_SETS; ++i) {
+
+        ds = &dict->sets[i];
+
+        if(0 == ds->rules ||
+           ds->rules + (size_t)ds->num_rules * sizeof(rule_t) > dict->size)
+            return(SMRZR_ERROR);
+
+        if(RULE_WORD == types[i] || RULE_KEY == types[i]) {
+            trie = NULL;
+        } else {
+            trie = PTR_ADD(const trie_t*, dict, ds->trie);
+            if(0 == ds->trie || ds->trie + sizeof(trie_t) > dict->size ||
+               ds->trie + TRIE_SZ(trie) > dict->size)
+                return(SMRZR_ERROR);
+        }
+
+        sets[i]->rules = PTR_ADD(const rule_t*, dict, ds->rules);
+        sets[i]->num_rules = ds->num_rules;
+        sets[i]->trie = trie;
+        sets[i]->type = types[i];
+        sets[i]->max_growth = ds->max_growth;
+    }
+
+    lang->dict = dict;
+    lang->dict_map_len = map_len;
+
+    return(SMRZR_OK);
+}
+
+status_t
+lang_compile(lang_t* lang)
+{
+    array_t   * eol[2];
+    dict_t    * dict, * image;
+    size_t      map_len;
+
+    if(NULL == (dict = (dict_t*)calloc(1, sizeof(dict_t))))
+        ERROR_RET;
+
+    dict->magic = DICT_MAGIC;
+    dict->version = DICT_VERSION;
+    dict->size = sizeof(dict_t);
+    dict->src_size = lang->stream.len;
+
+    /* stemmer rules are split once and matched in one pass over the word,
+       line break rules and their exceptions share one reversed trie */
+    eol[0] = lang->line_break;
+    eol[1] = lang->line_dont_break;
+
+    if(SMRZR_OK != dictset_compile(&dict, DICT_PRE1, &lang->pre1, 1, RULE_HEAD) ||
+       SMRZR_OK != dictset_compile(&dict, DICT_POST1, &lang->post1, 1, RULE_TAIL) ||
+       SMRZR_OK != dictset_compile(&dict, DICT_MANUAL, &lang->manual, 1, RULE_WORD) ||
+       SMRZR_OK != dictset_compile(&dict, DICT_SYNONYMS, &lang->synonyms, 1,
+                                   RULE_WORD) ||
+       SMRZR_OK != dictset_compile(&dict, DICT_PRE, &lang->pre, 1, RULE_HEAD) ||
+       SMRZR_OK != dictset_compile(&dict, DICT_POST, &lang->post, 1, RULE_TAIL) ||
+       SMRZR_OK != dictset_compile(&dict, DICT_EXCLUDE, &lang->exclude, 1,
+                                   RULE_KEY) ||
+       SMRZR_OK != dictset_compile(&dict, DICT_EOL, eol, 2, RULE_MARK))
+    {
+        free(dict);
+        ERROR_RET;
+    }
+
+    /* the image is kept read-only like a mapped compiled dictionary */
+    map_len = (1 + (dict->size / PAGESIZE)) * PAGESIZE;
+
+    if(MAP_FAILED == (image = (dict_t*)mmap(NULL, map_len, PROT_READ|PROT_WRITE,
+                                            MAP_PRIVATE|MAP_ANONYMOUS, -1, 0)))
+    {
+        perror("Error in mmap'ing dictionary: ");
+        free(dict);
+        ERROR_RET;
+    }
+
+    memcpy(image, dict, dict->size);
+    free(dict);
+
+    if(0 != mprotect(image, map_len, PROT_READ) ||
+       SMRZR_OK != lang_attach(lang, image, map_len))
+    {
+        munmap(image, map_len);
+        ERROR_RET;
+    }
+
+    /* nothing points into the xml any more */
+    stream_destroy(&lang->stream);
+
     return(SMRZR_OK);
 }
 
+uint32_t
+dict_alloc(dict_t** dict, size_t sz)
+{
+    dict_t    * d = *dict;
+    size_t      offset = DICT_ALIGN(d->size);
+
+    if(offset + sz > UINT32_MAX ||
+       NULL == (d = (dict_t*)realloc(d, offset + sz)))
+        return(0);
+
+    memset(PTR_ADD(char*, d, d->size), 0, offset + sz - d->size);
+
+    d->size = offset + sz;
+    *dict = d;
+
+    return(offset);
+}
+
+status_t
+dictset_compile(dict_t** dict, dictsetid_t id, array_t** raw, size_t num_raw,
+                ruletype_t type)
+{
+    string_t  * r;
+    rule_t    * rules, * rule;
+    trie_t    * trie = NULL;
+    uint32_t  * flags = NULL;
+    charpos_t   str, sep;
+    size_t      num_rules = 0, str_sz = 0, max_growth = 0, i, j;
+    uint32_t    rules_off, str_off, trie_off = 0;
+
+    /* whole words are looked up, so are kept sorted on 'from' */
+    if(RULE_WORD == type || RULE_KEY == type)
+        qsort(ARR_AT(raw[0], 0), ARR_SZ(raw[0]), sizeof(string_t),
+              comp_raw_rules);
+
+    for(i = 0; i < num_raw; ++i) {
+        for(r = (string_t*)ARR_FIRST(raw[i]); !ARR_END(raw[i]);
+            r = (string_t*)ARR_NEXT(raw[i]))
+        {
+            ++num_rules;
+            str_sz += strlen(*r) + 1;
+        }
+    }
+
+    if(0 == (rules_off = dict_alloc(dict, num_rules * sizeof(rule_t))) ||
+       0 == (str_off = dict_alloc(dict, str_sz)))
+        ERROR_RET;
+
+    if(RULE_MARK == type &&
+       NULL == (flags = (uint32_t*)malloc((num_rules + 1) * sizeof(uint32_t))))
+        ERROR_RET;
+
+    rule = rules = PTR_ADD(rule_t*, *dict, rules_off);
+    str = PTR_ADD(charpos_t, *dict, str_off);
+
+    for(i = 0; i < num_raw; ++i) {
+        for(r = (string_t*)ARR_FIRST(raw[i]); !ARR_END(raw[i]);
+            r = (string_t*)ARR_NEXT(raw[i]), ++rule)
+        {
+            strcpy(str, *r);
+
+            if(RULE_KEY == type || RULE_MARK == type) {
+                sep = str + strlen(str);
+            } else
+            if(NULL == (sep = strchr(str, RULE_SEPARATOR_CHAR))) {
+                fprintf(stderr, "Invalid rule '%s' without separator\n", *r);
+                ERROR_RET;
+            }
+
+            /* words are looked up lowercase, and stay so once replaced */
+            for(j = 0; str[j]; ++j) str[j] = tolower(str[j]);
+
+            rule->from = PTR_DIFF(str, rule);
+            rule->from_len = PTR_DIFF(sep, str);
+            rule->to = rule->from + rule->from_len + (0 != *sep ? 1 : 0);
+            rule->to_len = strlen(RULE_TO(rule));
+
+            if(RULE_WORD == type) {
+                if(0 == rule->to_len) {
+                    fprintf(stderr, "Invalid rule '%s' without replacement\n", *r);
+                    ERROR_RET;
+                }
+                if(rule->to_len > rule->from_len + max_growth)
+                    max_growth = rule->to_len - rule->from_len;
+            } else
+            if((RULE_HEAD == type || RULE_TAIL == type) &&
+               rule->from_len <= rule->to_len)
+            {
+                fprintf(stderr, "Invalid rule '%s' not shortening words\n", *r);
+                ERROR_RET;
+            }
+
+            if(NULL != flags) flags[rule - rules] = 1 << i;
+
+            str += strlen(str) + 1;
+        }
+    }
+
+    /* heads and tails are matched by a trie stored after the strings */
+    if(RULE_HEAD == type || RULE_TAIL == type || RULE_MARK == type) {
+
+        trie = trie_new(rules, num_rules, flags, RULE_HEAD != type);
+        free(flags);
+
+        if(NULL == trie || 0 == (trie_off = dict_alloc(dict, TRIE_SZ(trie)))) {
+            trie_free(trie);
+            ERROR_RET;
+        }
+
+        memcpy(PTR_ADD(trie_t*, *dict, trie_off), trie, TRIE_SZ(trie));
+        trie_free(trie);
+    }
+
+    (*dict)->sets[id].rules = rules_off;
+    (*dict)->sets[id].num_rules = num_rules;
+    (*dict)->sets[id].trie = trie_off;
+    (*dict)->sets[id].max_growth = max_growth;
+
+    return(SMRZR_OK);
+}
+
+const rule_t*
+ruleset_find(const ruleset_t* set, const char* word, size_t len)
+{
+    int     lo = 0, hi = set->num_rules - 1, mid;
+
+    while(lo <= hi) {
+
+        mid = (lo + hi)/2;
+
+        switch(comp_rule_with_word(&set->rules[mid], word, len)) {
+            case SMRZR_EQ: return(&set->rules[mid]);
+            case SMRZR_GT: hi = mid - 1; break;
+            case SMRZR_LT: lo = mid + 1; break;
+            default: assert(SMRZR_FALSE);
+        }
+    }
+
+    return(NULL);
+}
+
+size_t
+ruleset_apply(const ruleset_t* set, string_t word, size_t len)
+{
+    uint32_t        found;
+    const rule_t  * r;
+
+    if(RULE_WORD == set->type) {
+        if(NULL == (r = ruleset_find(set, word, len)))
+            return(len);
+        return(rule_apply_word(word, len, r));
+    }
+
+    /* first matching rule in dictionary order wins */
+    if(0 == (found = trie_match(set->trie, word, len)))
+        return(len);
+
+    if(RULE_TAIL == set->type)
+        return(rule_apply_tail(word, len, &set->rules[found - 1]));
+    else
+        return(rule_apply_head(word, len, &set->rules[found - 1]));
+}
+
+trie_t*
+trie_new(const rule_t* rules, size_t num_rules, const uint32_t* flags,
+         bool_t is_reversed)
+{
+    trie_t        * t, * shrunk;
+    const rule_t  * r;
+    literal_t       from;
+    uint32_t  * values;
+    uint16_t  * next, * slot;
+    size_t      max_nodes = 1, used = 1, node, i, c, index;
+    uint8_t     class_of[256];
+    uint32_t    num_classes = 0;
+
+    /* alphabet is only the characters used by rules, folded for case */
+    memset(class_of, 0, sizeof(class_of));
+
+    for(r = rules; r != rules + num_rules; ++r) {
+        for(i = 0, from = RULE_FROM(r); i < r->from_len; ++i) {
+            c = (uint8_t)from[i];
+            if(0 == class_of[c]) {
+                ++num_classes;
+                class_of[tolower(c)] = class_of[toupper(c)] = num_classes;
+            }
+        }
+        max_nodes += r->from_len;
+    }
+
+    if(max_nodes > TRIE_MAX_NODES) {
+        fprintf(stderr, "Too many rules to compile - %lu nodes\n", max_nodes);
+        return(NULL);
+    }
+
+    if(NULL == (t = (trie_t*)calloc(1, sizeof(trie_t) +
+                                       max_nodes * sizeof(uint32_t) +
+                                       max_nodes * num_classes * sizeof(uint16_t))))
+        return(NULL);
+
+    t->is_reversed = is_reversed;
+    t->num_nodes = max_nodes;
+    t->num_classes = num_classes;
+    memcpy(t->class_of, class_of, sizeof(class_of));
+
+    values = TRIE_VALUES(t);
+    next = TRIE_NEXT(t);
+
+    for(r = rules, index = 1; r != rules + num_rules; ++r, ++index) {
+        for(i = 0, node = 0, from = RULE_FROM(r); i < r->from_len; ++i) {
+            c = (uint8_t)from[is_reversed ? r->from_len - 1 - i : i];
+            slot = next + node * num_classes + class_of[c] - 1;
+            if(0 == *slot) *slot = used++;
+            node = *slot;
+        }
+
+        if(NULL != flags)
+            values[node] |= flags[index - 1];
+        else if(0 == values[node])
+            values[node] = index; /* earlier rule wins */
+    }
+
+    /* pack the next-node table right after the used values */
+    t->num_nodes = used;
+    memmove(TRIE_NEXT(t), next, used * num_classes * sizeof(uint16_t));
+
+    if(NULL != (shrunk = (trie_t*)realloc(t, sizeof(trie_t) +
+                                             used * sizeof(uint32_t) +
+                                             used * num_classes * sizeof(uint16_t))))
+        t = shrunk;
+
+    return(t);
+}
+
+uint32_t
+trie_match(const trie_t* t, const char* word, size_t len)
+{
+    const uint32_t  * values = TRIE_VALUES(t);
+    const uint16_t  * next = TRIE_NEXT(t);
+    uint32_t          found = 0, c;
+    size_t            node = 0, i;
+
+    /* a rule only matches a strict head or tail of the word */
+    for(i = 0; i + 1 < len; ++i) {
+
+        c = t->class_of[(uint8_t)word[t->is_reversed ? len - 1 - i : i]];
+
+        if(0 == c || 0 == (node = next[node * t->num_classes + c - 1]))
+            break;
+
+        if(0 != values[node] && (0 == found || values[node] < found))
+            found = values[node];
+    }
+
+    return(found);
+}
+
+uint32_t
+trie_match_flags(const trie_t* t, const char* word, size_t len)
+{
+    const uint32_t  * values = TRIE_VALUES(t);
+    const uint16_t  * next = TRIE_NEXT(t);
+    uint32_t          found = 0, c;
+    size_t            node = 0, i;
+
+    /* flags of all rules matching a strict head or tail of the word */
+    for(i = 0; i + 1 < len; ++i) {
+
+        c = t->class_of[(uint8_t)word[t->is_reversed ? len - 1 - i : i]];
+
+        if(0 == c || 0 == (node = next[node * t->num_classes + c - 1]))
+            break;
+
+        found |= values[node];
+    }
+
+    return(found);
+}
+
+size_t
+rule_apply_head(string_t word, size_t len, const rule_t* r)
+{
+    memmove(word + r->to_len, word + r->from_len, len - r->from_len + 1);
+
+    memcpy(word, RULE_TO(r), r->to_len);
+
+    return(len - r->from_len + r->to_len);
+}
+
+size_t
+rule_apply_tail(string_t word, size_t len, const rule_t* r)
+{
+    memcpy(word + len - r->from_len, RULE_TO(r), r->to_len + 1);
+
+    return(len - r->from_len + r->to_len);
+}
+
+size_t
+rule_apply_word(string_t word, size_t len, const rule_t* r)
+{
+    /* caller makes room for the ruleset's max_growth */
+    memcpy(word, RULE_TO(r), r->to_len + 1);
+
+    return(r->to_len);
+}
+
 status_t
 parse_stemmer_xml(lang_t* lang)
 {
@@ -263,10 +808,11 @@ array_add_elemptr(array_t** array, elem_t elem)
 }
 
 status_t
-article_init(article_t* article)
+article_init(article_t* article, bool_t is_huge) /* huge pages for its stack */
 {
 #define SENTENCE_ESTIMATE    100
 #define WORDS_ESTIMATE       400
+#define TOKENS_ESTIMATE      4000
 
     article->num_words = 0;
 
@@ -274,32 +820,76 @@ article_init(article_t* article)
                                       SENTENCE_ESTIMATE, NULL)))
         ERROR_RET;
 
-    if(NULL == (article->words = array_new(SMRZR_TRUE, sizeof(word_t),
+    if(NULL == (article->stems = array_new(SMRZR_TRUE, sizeof(string_t),
                                       WORDS_ESTIMATE, NULL)))
         ERROR_RET;
 
-    if(NULL == (article->stack = array_new(SMRZR_FALSE, 0, 0, NULL)))
+    if(NULL == (article->counts = array_new(SMRZR_TRUE, sizeof(uint32_t),
+                                      WORDS_ESTIMATE, NULL)))
+        ERROR_RET;
+
+    if(NULL == (article->weights = array_new(SMRZR_TRUE, sizeof(uint32_t),
+                                      WORDS_ESTIMATE, NULL)))
+        ERROR_RET;
+
+    if(NULL == (article->word_index = hash_new(HASH_DEFAULT_SLOTS, NULL)))
+        ERROR_RET;
+
+    if(NULL == (article->tokens = array_new(SMRZR_TRUE, sizeof(uint32_t),
+                                      TOKENS_ESTIMATE, NULL)))
+        ERROR_RET;
+
+    arena_init(&article->stack, is_huge);
+
+    if(NULL == (article->ranking = array_new(SMRZR_TRUE, sizeof(uint32_t),
+                                      SENTENCE_ESTIMATE, NULL)))
+        ERROR_RET;
+
+    if(NULL == (article->terms = array_new(SMRZR_TRUE, sizeof(uint32_t),
+                                      WORDS_ESTIMATE, NULL)))
         ERROR_RET;
 
     memset(&article->stream, 0, sizeof(stream_t));
 
+    article->owned_buf = NULL;
+
     return(SMRZR_OK);
 }
 
 status_t
-parse_article(const char* file_name, lang_t* lang, article_t* article)
+parse_article(const char* file_name, const lang_t* lang, article_t* article)
+{
+    /* read-only, so shared with the page cache */
+    if(SMRZR_OK != stream_create(file_name, &article->stream, SMRZR_FALSE))
+        ERROR_RET;
+
+    return(parse_article_stream(lang, article));
+}
+
+status_t
+parse_article_buffer(const char* buf, size_t len, const lang_t* lang,
+                     article_t* article)
+{
+    /* sentences point into it, it is never written */
+    if(SMRZR_OK != stream_from_buffer(&article->stream, buf, len))
+        ERROR_RET;
+
+    return(parse_article_stream(lang, article));
+}
+
+status_t
+parse_article_stream(const lang_t* lang, article_t* article)
 {
     string_t    word, word_core, word_stem;
     sentence_t* sentence;
-    word_t*     word_entry;
+    string_t*   stem_entry;
+    uint32_t*   token, * count;
     stream_t*   stream = &article->stream;
-    bool_t      is_new, is_para_end = SMRZR_FALSE;
+    bool_t      is_new, is_excluded, is_proper, is_para_end = SMRZR_FALSE;
+    size_t      word_len;
 
     PROF_START;
 
-    if(SMRZR_OK != stream_create(file_name, stream))
-        ERROR_RET;
-
     while(!STREAM_END(stream)) {
 
         STREAM_FIND_WORD(stream);
@@ -309,6 +899,8 @@ parse_article(const char* file_name, lang_t* lang, article_t* article)
         sentence = sentence_new(&article->sentences, article->stream.curr);
         assert(NULL != sentence);
 
+        sentence->first_token = ARR_SZ(article->tokens);
+
         if(SMRZR_TRUE == is_para_end) {
             sentence->is_para_begin = SMRZR_TRUE;
             is_para_end = SMRZR_FALSE;
@@ -316,36 +908,50 @@ parse_article(const char* file_name, lang_t* lang, article_t* article)
 
         while(!STREAM_END(stream)) {
 
-            STREAM_GET_WORD(stream, word, is_para_end);
-            
+            STREAM_GET_WORD(stream, word, word_len, is_para_end);
+
             sentence->num_words++;
 
-            if(NULL == (word_core = get_word_core(&article->stack, lang, word)))
+            if(NULL == (word_core = get_word_core(&article->stack, lang, word,
+                                                  word_len, &is_proper)))
                 ERROR_RET;
 
-            if(NULL == array_search(lang->exclude, word_core, comp_strings)) {
+            is_excluded = (NULL != ruleset_find(&lang->exclude_set, word_core,
+                                                strlen(word_core)));
 
-                if(NULL == (word_stem = get_word_stem(&article->stack, lang,
-                                                      word_core, SMRZR_TRUE)))
-                    ERROR_RET;
+            if(NULL == (word_stem = get_word_stem(&article->stack, lang,
+                                                  word_core, is_proper)))
+                ERROR_RET;
 
-                if(NULL == (word_entry = array_search_or_alloc(&article->words,
-                                        word_stem, comp_word_by_stem, &is_new)))
-                    ERROR_RET;
+            if(NULL == (stem_entry = hash_search_or_alloc(
+                                    &article->word_index, &article->stems,
+                                    word_stem, hash_string(word_stem),
+                                    comp_stems, &is_new)))
+                ERROR_RET;
 
-                if(SMRZR_TRUE == is_new) {
-                    word_entry->num_occ = 1;
-                    word_entry->stem = word_stem;
-                } else {
-                    ++(word_entry->num_occ);
-                    array_pop_free(article->stack, word_stem);
-                }
+            if(NULL == (token = (uint32_t*)array_alloc(&article->tokens)))
+                ERROR_RET;
+
+            *token = ARR_INDEX(article->stems, stem_entry);
+
+            /* a stem is interned once, its id then counts its occurrences;
+               excluded words are kept with no occurrences, grading used to
+               score them if a counted word had the same stem */
+            if(SMRZR_TRUE == is_new) {
+                if(NULL == (count = (uint32_t*)array_alloc(&article->counts)))
+                    ERROR_RET;
+                *count = (SMRZR_TRUE == is_excluded) ? 0 : 1;
+                *stem_entry = word_stem;
             } else {
-                array_pop_free(article->stack, word_core);
+                count = (uint32_t*)ARR_AT(article->counts, *token);
+                if(SMRZR_FALSE == is_excluded) ++(*count);
+                arena_pop_free(&article->stack, word_stem);
             }
+            ++(sentence->num_tokens);
 
-            if(end_of_line(lang, word)) {
-                sentence->end = word + strlen(word);
+            /* the last word ends the sentence even without a full stop */
+            if(end_of_line(lang, word, word_len) || STREAM_END(stream)) {
+                sentence->end = word + word_len;
                 article->num_words += sentence->num_words;
                 break;
             }
@@ -355,7 +961,7 @@ parse_article(const char* file_name, lang_t* lang, article_t* article)
     PROF_END("article parsing");
 
     /*fprintf(stdout, "Number of sentences - %lu\n", ARR_SZ(article->sentences));
-    fprintf(stdout, "Number of words - %lu\n", ARR_SZ(article->words));*/
+    fprintf(stdout, "Number of words - %lu\n", ARR_SZ(article->stems));*/
 
     return(SMRZR_OK);
 }
@@ -364,79 +970,218 @@ parse_article(const char* file_name, lang_t* lang, article_t* article)
 static uint32_t occ2score[] = { 3, 2, 2, 2, 1 };
 
 status_t
-grade_article(article_t* article, lang_t* lang, float ratio)
-{
-    array_t     * a, * temp;
-    word_t      * w;
-    sentence_t  * s, * s_score;
-    size_t        top_occs[] = { 0, 0, 0, 0}, occs, i, max_words;
-    word_t      * top_words[] = { 0, 0, 0, 0};
-    string_t      ws, ws_stem;
+grade_article(article_t* article, const lang_t* lang, float ratio)
+{
+    if(SMRZR_OK != rank_article(article, lang))
+        ERROR_RET;
+
+    select_sentences(article, ratio);
+
+    return(SMRZR_OK);
+}
+
+/* running counts over slots, for the sentence ranking below */
+
+static void
+counts_add(uint32_t* tree, size_t num, size_t slot, int delta)
+{
+    for(++slot; slot <= num; slot += slot & (~slot + 1))
+        tree[slot] += delta;
+}
+
+static size_t
+counts_sum(const uint32_t* tree, size_t slot) /* of the slots before */
+{
+    size_t sum = 0;
+
+    for(; slot > 0; slot -= slot & (~slot + 1))
+        sum += tree[slot];
+
+    return(sum);
+}
+
+static size_t
+counts_find(const uint32_t* tree, size_t num, size_t k) /* k'th counted slot */
+{
+    size_t slot = 0, step = 1;
+
+    while((step << 1) <= num) step <<= 1;
+
+    for(; step > 0; step >>= 1) {
+        if(slot + step <= num && tree[slot + step] <= k) {
+            slot += step;
+            k -= tree[slot];
+        }
+    }
+
+    return(slot);
+}
+
+/* Ranks sentences best first. Equal scores keep the order they always had:
+   going through the document, each sentence was inserted in a sorted list
+   at the first slot that a binary search hit inside the run of its score.
+   Instead of inserting, the slot is worked out from how many sentences of
+   better scores and of its own are in already, and each run is laid out
+   afterwards - later sentences push back earlier ones, so going backwards
+   every sentence takes the slot of its run that is still free at its
+   offset. */
+static status_t
+rank_by_score(article_t* article)
+{
+    scored_t   * scored;
+    sentence_t * s;
+    uint32_t   * run, * offset, * run_begin, * run_tree, * free_tree, * rank;
+    size_t       num, num_runs = 0, above, equal, slot, i;
+    ssize_t      lo, hi, mid;
+
+    array_reset(article->ranking);
+
+    if(0 == (num = ARR_SZ(article->sentences)))
+        return(SMRZR_OK);
+
+    for(i = 0; i < num; ++i) {
+        if(NULL == array_alloc(&article->ranking))
+            ERROR_RET;
+    }
+
+    if(NULL == (scored = (scored_t*)malloc(num * sizeof(scored_t) +
+                                           (5 * num + 2) * sizeof(uint32_t))))
+        ERROR_RET;
+
+    run = (uint32_t*)(scored + num);
+    offset = run + num;
+    run_begin = offset + num;
+    run_tree = run_begin + num;
+    free_tree = run_tree + num + 1;
+
+    for(i = 0; i < num; ++i) {
+        s = (sentence_t*)ARR_AT(article->sentences, i);
+        scored[i].score = s->score;
+        scored[i].index = i;
+    }
+
+    qsort(scored, num, sizeof(scored_t), comp_scored);
+
+    for(i = 0; i < num; ++i) {
+        if(0 == i || scored[i].score != scored[i-1].score)
+            run_begin[num_runs++] = i;
+
+        run[scored[i].index] = num_runs - 1;
+    }
+
+    /* the slot each sentence went in, as an offset into its run */
+    memset(run_tree, 0, (num_runs + 1) * sizeof(uint32_t));
+
+    for(i = 0; i < num; ++i) {
+        above = counts_sum(run_tree, run[i]);
+        equal = counts_sum(run_tree, run[i] + 1) - above;
+
+        lo = 0;
+        hi = (ssize_t)i - 1;
+
+        while(lo <= hi) {
+            mid = (lo + hi)/2;
+
+            if((size_t)mid < above) lo = mid + 1;
+            else if((size_t)mid >= above + equal) hi = mid - 1;
+            else { lo = mid; break; }
+        }
+
+        offset[i] = lo - above;
+        counts_add(run_tree, num_runs, run[i], 1);
+    }
+
+    /* every slot is free to begin with */
+    for(i = 1; i <= num; ++i)
+        free_tree[i] = i & (~i + 1);
+
+    rank = (uint32_t*)ARR_AT(article->ranking, 0);
+
+    for(i = num; i-- > 0; ) {
+        slot = counts_find(free_tree, num,
+                           counts_sum(free_tree, run_begin[run[i]]) + offset[i]);
+        rank[slot] = i;
+        counts_add(free_tree, num, slot, -1);
+    }
+
+    free(scored);
+
+    return(SMRZR_OK);
+}
+
+status_t
+rank_article(article_t* article, const lang_t* lang)
+{
+    array_t     * a;
+    sentence_t  * s;
+    uint32_t      top_occs[] = { 0, 0, 0, 0};
+    uint32_t      top_words[] = { 0, 0, 0, 0};
+    uint32_t    * counts, * weights, * tokens, * t, * t_end;
+    size_t        num, occs, i, id;
     bool_t        is_first = SMRZR_TRUE;
 
     PROF_START;
 
-    /* find top occs and corresponding words */
-    a = article->words;
+    /* find top occs and corresponding word ids */
+    num = ARR_SZ(article->counts);
+    counts = (uint32_t*)ARR_AT(article->counts, 0);
 
-    for(w = (word_t*)ARR_FIRST(a); !ARR_END(a); w = (word_t*)ARR_NEXT(a)) {
+    for(id = 0; id < num; ++id) {
         for(occs = 0; occs < TOP_OCCS_MAX; ++occs) {
-            if(top_occs[occs] < w->num_occ) {
+            if(top_occs[occs] < counts[id]) {
                 for(i = TOP_OCCS_MAX-1; i > occs; --i) {
                     top_occs[i] = top_occs[i-1];
                     top_words[i] = top_words[i-1];
                 }
-                top_occs[occs] = w->num_occ;
-                top_words[occs] = w;
+                top_occs[occs] = counts[id];
+                top_words[occs] = id;
                 break;
             }
         }
     }
 
     /*for(occs = 0; occs < TOP_OCCS_MAX; ++occs) {
-        fprintf(stdout, "top occ %lu - %lu [%s]\n", occs, top_occs[occs],
-               top_words[occs]->stem);
+        fprintf(stdout, "top occ %lu - %u [%s]\n", occs, top_occs[occs],
+               ((string_t*)ARR_AT(article->stems, top_words[occs]))[0]);
     }*/
 
-    /* score all sentences */
-    a = article->sentences;
+    /* weigh every word once, sentences then just add up their tokens */
+    array_reset(article->weights);
 
-    for(s=(sentence_t*)ARR_FIRST(a); !ARR_END(a); s=(sentence_t*)ARR_NEXT(a)) {
-
-        ws = s->begin;
+    for(id = 0; id < num; ++id) {
+        if(NULL == array_alloc(&article->weights))
+            ERROR_RET;
+    }
 
-        while(ws < s->end) {
+    weights = (uint32_t*)ARR_AT(article->weights, 0);
 
-            while(0 == *ws && ws < s->end) ++ws;
+    for(id = 0; id < num; ++id) {
 
-            if(ws >= s->end) break;
+        occs = 0;
+        while(occs < TOP_OCCS_MAX && top_occs[occs] != counts[id]) ++occs;
 
-            if(NULL == (ws_stem = get_word_stem(&article->stack, lang, ws,
-                                                SMRZR_FALSE)))
+        switch(occ2score[occs]) {
+            case 3: /* score += occ * 3 */
+                weights[id] = ((counts[id] << 1) + counts[id]); break;
+            case 2: /* score += occ * 2 */
+                weights[id] = (counts[id] << 1); break;
+            case 1: /* score += occ */
+                weights[id] = counts[id]; break;
+            default: 
                 ERROR_RET;
+        }
+    }
 
-            if(NULL == (w = (word_t*)array_search(article->words, ws_stem,
-                                                  comp_word_by_stem)))
-            { /* possibly a word excluded */
-                ws = ws + strlen(ws);
-                continue;
-            }
+    /* score all sentences */
+    a = article->sentences;
+    tokens = (uint32_t*)ARR_AT(article->tokens, 0);
 
-            occs = 0;
-            while(top_occs[occs] != w->num_occ && occs < TOP_OCCS_MAX) ++occs;
-
-            switch(occ2score[occs]) {
-                case 3: /* score += occ * 3 */
-                    s->score += ((w->num_occ << 1) + w->num_occ); break;
-                case 2: /* score += occ * 2 */
-                    s->score += (w->num_occ << 1); break;
-                case 1: /* score += occ */
-                    s->score += w->num_occ; break;
-                default: 
-                    ERROR_RET;
-            }
+    for(s=(sentence_t*)ARR_FIRST(a); !ARR_END(a); s=(sentence_t*)ARR_NEXT(a)) {
+
+        t_end = tokens + s->first_token + s->num_tokens;
 
-            ws = ws + strlen(ws);
+        for(t = tokens + s->first_token; t < t_end; ++t) {
+            s->score += weights[*t];
         }
 
         if(SMRZR_TRUE == s->is_para_begin) {
@@ -451,213 +1196,161 @@ grade_article(article_t* article, lang_t* lang, float ratio)
 
     /*fprintf(stdout, "\n");*/
 
-    /* sort on sentence score */
-    if(NULL == (temp = array_new(SMRZR_TRUE, sizeof(sentence_t),
-                                 ARR_SZ(article->sentences), NULL)))
+    /* rank on sentence score, best first */
+    if(SMRZR_OK != rank_by_score(article))
         ERROR_RET;
 
-    for(s=(sentence_t*)ARR_FIRST(a); !ARR_END(a); s=(sentence_t*)ARR_NEXT(a)) {
-        if(NULL == (s_score = array_sorted_alloc(&temp, (elem_t)(size_t)(s->score),
-                                                 comp_sentence_by_score)))
-            ERROR_RET;
+    PROF_END("article grading");
 
-        memcpy(s_score, s, sizeof(sentence_t));
-        s_score->cookie = (elem_t)s;
-    }
+    return(SMRZR_OK);
+}
+
+void
+select_sentences(article_t* article, float ratio)
+{
+    array_t     * a;
+    sentence_t  * s, * sentences;
+    uint32_t    * rank;
+    ssize_t       max_words;
+
+    a = article->sentences;
+    for(s=(sentence_t*)ARR_FIRST(a); !ARR_END(a); s=(sentence_t*)ARR_NEXT(a))
+        s->is_selected = SMRZR_FALSE;
+
+    sentences = (sentence_t*)ARR_AT(a, 0);
 
     /* pick sentences with highest scores until we get required ratio of words*/
     max_words = article->num_words * ratio;
 
-    a = temp;
-    for(s=(sentence_t*)ARR_FIRST(a); !ARR_END(a) && (ssize_t)max_words > 0;
-                                     s=(sentence_t*)ARR_NEXT(a))
+    a = article->ranking;
+    for(rank=(uint32_t*)ARR_FIRST(a); !ARR_END(a) && max_words > 0;
+                                      rank=(uint32_t*)ARR_NEXT(a))
     {
-        ((sentence_t*)s->cookie)->is_selected = SMRZR_TRUE;
+        s = &sentences[*rank];
+        s->is_selected = SMRZR_TRUE;
         max_words -= s->num_words;
         /*fprintf(stdout, "Selected sentence: score %u, %lu words, %ld
-          remaining\n", s->score, s->num_words, (ssize_t)max_words);*/
+          remaining\n", s->score, s->num_words, max_words);*/
     }
-
-    array_free(temp);
-
-    PROF_END("article grading");
-
-    return(SMRZR_OK);
 }
 
-string_t
-get_word_stem(array_t** stack, lang_t* lang, const string_t word, bool_t is_core)
+status_t
+rank_terms(article_t* article, size_t max_terms) /* 0 for all */
 {
-    string_t  changed, copy, *r;
-    array_t*  a;
-
-    if(SMRZR_TRUE == is_core) {
-        changed = word;
-    } else {
-        if(NULL == (changed = get_word_core(stack, lang, word)))
-            return(NULL);
-    }
+    scored_t    * scored;
+    uint32_t    * counts, * term;
+    size_t        num = 0, num_ids, id, i;
 
-    if(isupper(changed[0]) && strlen(changed) > 1) return(changed);
+    array_reset(article->terms);
 
-    copy = array_push_alloc(stack, strlen(changed)+1);
-    strcpy(copy, changed);
+    if(0 == (num_ids = ARR_SZ(article->counts)))
+        return(SMRZR_OK);
 
-    a = lang->manual;
+    if(NULL == (scored = (scored_t*)malloc(num_ids * sizeof(scored_t))))
+        ERROR_RET;
 
-    if(NULL!=(r=(string_t*)array_search(a, changed, comp_string_with_rule))){
-        replace_word(stack, changed, *r);
-    }
+    counts = (uint32_t*)ARR_AT(article->counts, 0);
 
-    a = lang->pre;
+    /* excluded words are counted too, without occurrences */
+    for(id = 0; id < num_ids; ++id) {
+        if(0 == counts[id]) continue;
 
-    for(r = (string_t*)ARR_FIRST(a); !ARR_END(a); r = (string_t*)ARR_NEXT(a)) {
-        if(SMRZR_TRUE == replace_word_head(changed, *r)) break;
+        scored[num].score = counts[id];
+        scored[num].index = id;
+        ++num;
     }
 
-    a = lang->post;
-
-    for(r = (string_t*)ARR_FIRST(a); !ARR_END(a); r = (string_t*)ARR_NEXT(a)) {
-        if(SMRZR_TRUE == replace_word_tail(changed, *r)) break;
-    }
+    /* equal counts stay in the order the words first came in */
+    qsort(scored, num, sizeof(scored_t), comp_scored);
 
-    a = lang->synonyms;
+    if(0 == max_terms || max_terms > num)
+        max_terms = num;
 
-    if(NULL!=(r=(string_t*)array_search(a, changed, comp_string_with_rule))){
-        replace_word(stack, changed, *r);
+    for(i = 0; i < max_terms; ++i) {
+        if(NULL == (term = (uint32_t*)array_alloc(&article->terms))) {
+            free(scored);
+            ERROR_RET;
+        }
+        *term = scored[i].index;
     }
 
-    /* quality check */
-    if(strlen(changed) < 3) {
-        memmove(changed, copy, strlen(copy)+1);
-        (*stack)->curr = PTR_ADD(elem_t, changed, strlen(changed)+1);
-    } else {
-        array_pop_free(*stack, copy);
-    }
+    free(scored);
 
-    return(changed);
+    return(SMRZR_OK);
 }
 
 string_t
-get_word_core(array_t** stack, lang_t* lang, const string_t word)
+get_word_stem(arena_t* stack, const lang_t* lang, const string_t core,
+              bool_t is_proper)
 {
-    size_t    sz = strlen(word)+1, i;
-    string_t  changed = array_push_alloc(stack, sz), *r;
-    array_t*  a;
-
-    if(NULL == changed) return(NULL);
-
-    strcpy(changed, word);
-
-    if(isupper(changed[0]) && strlen(changed) > 1) return(changed);
-
-    for(i = 0; i < sz; ++i) changed[i] = tolower(changed[i]);
-
-    a = lang->pre1;
-
-    for(r = (string_t*)ARR_FIRST(a); !ARR_END(a); r = (string_t*)ARR_NEXT(a)) {
-        if(SMRZR_TRUE == replace_word_head(changed, *r)) break;
-    }
-
-    a = lang->post1;
-
-    for(r = (string_t*)ARR_FIRST(a); !ARR_END(a); r = (string_t*)ARR_NEXT(a)) {
-        if(SMRZR_TRUE == replace_word_tail(changed, *r)) break;
-    }
-
-    return(changed);
-}
+    string_t  changed = core, stem;
+    size_t    len;
 
-bool_t
-replace_word_head(string_t word, string_t rule)
-{
-    bool_t   res = SMRZR_FALSE;
-    string_t from;
-    size_t   word_len = strlen(word), from_len, to_len;
+    /* the core is on top of the stack, as get_word_core left it */
+    if(SMRZR_TRUE == is_proper) return(changed);
 
-    from = strsep(&rule, RULE_SEPARATOR_STR);
+    /* stem a copy on top of the core, with room for replacements that
+       lengthen the word; the core is kept if the stem is too short */
+    len = strlen(changed);
 
-    from_len = strlen(from);
+    if(NULL == (stem = arena_push_alloc(stack, len + 1 +
+                                        lang->manual_set.max_growth +
+                                        lang->synonyms_set.max_growth)))
+        return(NULL);
 
-    assert(from_len > strlen(rule));
+    memcpy(stem, changed, len + 1);
 
-    if(MATCH_AT_BEG(word, from, word_len, from_len)) {
+    len = ruleset_apply(&lang->manual_set, stem, len);
 
-        to_len = strlen(rule);
+    len = ruleset_apply(&lang->pre_set, stem, len);
 
-        memmove(word + to_len, word + from_len, word_len - from_len + 1);
+    len = ruleset_apply(&lang->post_set, stem, len);
 
-        if(0 != *rule) {
-            memcpy(word, rule, to_len);
-        }
+    len = ruleset_apply(&lang->synonyms_set, stem, len);
 
-        res = SMRZR_TRUE;
+    /* quality check */
+    if(len < 3) {
+        arena_pop_free(stack, stem);
+        return(changed);
     }
 
-    *(rule-1) = RULE_SEPARATOR_CHAR; /* undo rule tokenizing */
-
-    return(res);
-}
-
-bool_t
-replace_word_tail(string_t word, string_t rule)
-{
-    bool_t   res = SMRZR_FALSE;
-    string_t from;
-    size_t   word_len = strlen(word), from_len;
-
-    from = strsep(&rule, RULE_SEPARATOR_STR);
-
-    from_len = strlen(from);
-
-    assert(from_len > strlen(rule));
-
-    if(MATCH_AT_END(word, from, word_len, from_len)) {
-
-        if(0 == *rule) /* nothing to replace with */
-            *(word + word_len - from_len) = 0;
-        else
-            strcpy(word + word_len - from_len, rule);
+    /* the stem takes the core's place; it may be in a later chunk, which
+       is kept unchanged by the pop, so it is moved to wherever the push
+       lands, overlapping or not */
+    arena_pop_free(stack, changed);
 
-        res = SMRZR_TRUE;
-    }
+    if(NULL == (changed = arena_push_alloc(stack, len + 1)))
+        return(NULL);
 
-    *(rule-1) = RULE_SEPARATOR_CHAR; /* undo rule tokenizing */
+    memmove(changed, stem, len + 1);
 
-    return(res);
+    return(changed);
 }
 
-void
-replace_word(array_t** stack, string_t word, string_t rule)
+string_t
+get_word_core(arena_t* stack, const lang_t* lang, const char* word,
+              size_t len, bool_t* is_proper)
 {
-    string_t from;
-    size_t   word_len = strlen(word), to_len, offset;
-
-    from = strsep(&rule, RULE_SEPARATOR_STR);
-
-    assert(0 != *rule); /* something to replace must be there */
-
-    /*fprintf(stdout, "%s %s\n", word, from);*/
+    size_t    i;
+    string_t  changed = arena_push_alloc(stack, len + 1);
 
-    if(0 != strcasecmp(word, from)) return;
-
-    to_len = strlen(rule);
-
-    if(to_len > word_len) { /* need to extend 'word' memory */
+    if(NULL == changed) return(NULL);
 
-        if(ARR_FULL(*stack, to_len - word_len)) { /* re-alloc, adjust word */
+    /* the word is a span of the article, copied out lowercase to be
+       changed: from here on words are compared as bytes */
+    for(i = 0; i < len; ++i) changed[i] = tolower(word[i]);
+    changed[len] = 0;
 
-            offset = PTR_DIFF(word, *stack);
+    /* capitalized, it is taken for a proper noun and left whole */
+    *is_proper = (isupper(word[0]) && 1 < len) ? SMRZR_TRUE : SMRZR_FALSE;
 
-            assert(NULL != (*stack = array_new(SMRZR_FALSE, 0, 0, *stack)));
+    if(SMRZR_TRUE == *is_proper) return(changed);
 
-            word = PTR_ADD(string_t, *stack, offset);
-        }
-    }
+    len = ruleset_apply(&lang->pre1_set, changed, len);
 
-    strcpy(word, rule); /* replace */
+    ruleset_apply(&lang->post1_set, changed, len);
 
-    (*stack)->curr = PTR_ADD(elem_t, word, to_len + 1); /* adjust curr */
+    return(changed);
 }
 
 void
@@ -776,73 +1469,287 @@ array_search_or_alloc(array_t** array, const elem_t key, compfunc_t cf, bool_t*
     return(elem);
 }
 
+hash_t*
+hash_new(size_t num_slots, hash_t* orig)
+{
+    hash_t  * hash;
+    slot_t  * slots, * from, * to;
+    size_t    i, mask;
+
+    assert(0 == (num_slots & (num_slots - 1)));
+
+    if(NULL == (hash = (hash_t*)calloc(1, sizeof(hash_t) +
+                                          num_slots * sizeof(slot_t))))
+        return(NULL);
+
+    hash->num_slots = num_slots;
+
+    if(NULL == orig) return(hash);
+
+    /* re-seat the used slots of the original; hashes are kept in slots so
+       the keys themselves are not needed */
+    slots = HASH_SLOTS(hash);
+    mask = num_slots - 1;
+
+    for(i = 0, from = HASH_SLOTS(orig); i < orig->num_slots; ++i, ++from) {
+
+        if(0 == from->index) continue;
+
+        for(to = slots + (from->hash & mask); 0 != to->index;
+            to = slots + ((to - slots + 1) & mask));
+
+        *to = *from;
+    }
+
+    hash->num_used = orig->num_used;
+
+    hash_free(orig);
+
+    return(hash);
+}
+
+uint32_t
+hash_string(const char* s)
+{
+    uint32_t h = 2166136261u; /* FNV-1a, of keys kept lowercase */
+
+    for(; *s; ++s) {
+        h ^= (uint8_t)*s;
+        h *= 16777619u;
+    }
+
+    return(h);
+}
+
 elem_t
-array_push_alloc(array_t** array, size_t sz)
+hash_search(const hash_t* h, const array_t* a, const elem_t key, uint32_t hval,
+            compfunc_t cf)
 {
-    elem_t elem;
-    array_t* a = *array;
+    const slot_t  * slots = HASH_SLOTS(h), * slot;
+    size_t          mask = h->num_slots - 1;
+    elem_t          elem;
+
+    for(slot = slots + (hval & mask); 0 != slot->index;
+        slot = slots + ((slot - slots + 1) & mask))
+    {
+        if(slot->hash != hval) continue;
+
+        elem = ARR_AT(a, slot->index - 1);
+
+        if(SMRZR_EQ == cf(elem, key)) return(elem);
+    }
 
-    assert(SMRZR_FALSE == a->is_array);
+    return(NULL);
+}
+
+elem_t
+hash_search_or_alloc(hash_t** hash, array_t** array, const elem_t key,
+                     uint32_t hval, compfunc_t cf, bool_t* is_new)
+{
+    hash_t  * h = *hash;
+    slot_t  * slots, * slot;
+    size_t    mask;
+    elem_t    elem;
+
+    if(NULL != (elem = hash_search(h, *array, key, hval, cf))) {
+        *is_new = SMRZR_FALSE;
+        return(elem);
+    }
 
-    if(ARR_FULL(a, sz)) {
-        if(NULL == (*array = array_new(SMRZR_FALSE, 0, 0, a)))
+    if(HASH_FULL(h)) {
+        if(NULL == (*hash = hash_new(2 * h->num_slots, h)))
             return(NULL);
-        a = *array;
+        h = *hash;
     }
 
-    elem = a->curr;
-    a->curr = PTR_ADD(elem_t, a->curr, sz);
+    if(NULL == (elem = array_alloc(array)))
+        return(NULL);
+
+    slots = HASH_SLOTS(h);
+    mask = h->num_slots - 1;
+
+    for(slot = slots + (hval & mask); 0 != slot->index;
+        slot = slots + ((slot - slots + 1) & mask));
+
+    slot->hash = hval;
+    slot->index = ARR_INDEX((*array), elem) + 1;
+
+    ++(h->num_used);
+
+    *is_new = SMRZR_TRUE;
+
+    return(elem);
+}
+
+void
+arena_init(arena_t* arena, bool_t is_huge)
+{
+    /* chunks are only added once something is pushed */
+    arena->chunks = arena->free = NULL;
+    arena->is_huge = is_huge;
+}
+
+static chunk_t*
+chunk_new(const arena_t* arena, size_t sz)
+{
+    chunk_t * c;
+    size_t    len = sizeof(chunk_t) + sz;
+
+    if(SMRZR_TRUE == arena->is_huge) {
+        len = (1 + (len - 1) / ARENA_HUGE_CHUNK_SZ) * ARENA_HUGE_CHUNK_SZ;
+
+        c = MAP_FAILED;
+#if defined MAP_HUGETLB
+        /* huge pages set aside, if there are any */
+        c = (chunk_t*)mmap(NULL, len, PROT_READ|PROT_WRITE,
+                           MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+#endif
+        if(MAP_FAILED == c) {
+            if(MAP_FAILED == (c = (chunk_t*)mmap(NULL, len, PROT_READ|PROT_WRITE,
+                                                 MAP_PRIVATE|MAP_ANONYMOUS, -1, 0)))
+                return(NULL);
+#if defined MADV_HUGEPAGE
+            madvise(c, len, MADV_HUGEPAGE); /* else transparent ones, a hint */
+#endif
+        }
+
+        c->map_len = len;
+    } else {
+        if(len < ARENA_CHUNK_SZ) len = ARENA_CHUNK_SZ;
+
+        if(NULL == (c = (chunk_t*)malloc(len)))
+            return(NULL);
+
+        c->map_len = 0;
+    }
+
+    c->curr = CHUNK_DATA(c);
+    c->end = PTR_ADD(char*, c, len);
+
+    return(c);
+}
+
+static void
+chunks_free(chunk_t* c)
+{
+    chunk_t * next;
+
+    for(; NULL != c; c = next) {
+        next = c->next;
+        if(0 != c->map_len) munmap(c, c->map_len);
+        else free(c);
+    }
+}
+
+void
+arena_destroy(arena_t* arena)
+{
+    chunks_free(arena->chunks);
+    chunks_free(arena->free);
+    arena_init(arena, arena->is_huge);
+}
+
+void
+arena_reset(arena_t* arena)
+{
+    chunk_t * c;
+
+    /* kept for the next article */
+    while(NULL != (c = arena->chunks)) {
+        arena->chunks = c->next;
+        c->next = arena->free;
+        arena->free = c;
+    }
+}
+
+elem_t
+arena_push_alloc(arena_t* arena, size_t sz)
+{
+    chunk_t  * c = arena->chunks, ** f;
+    elem_t     elem;
+
+    if(NULL == c || sz > (size_t)(c->end - c->curr)) {
+
+        /* a free chunk big enough, else a new one; what is left of the
+           one in use waits till it is popped back to */
+        for(f = &arena->free;
+            NULL != *f && sz > (size_t)((*f)->end - CHUNK_DATA(*f));
+            f = &(*f)->next)
+            ;
+
+        if(NULL != (c = *f)) {
+            *f = c->next;
+            c->curr = CHUNK_DATA(c);
+        } else if(NULL == (c = chunk_new(arena, sz))) {
+            return(NULL);
+        }
+
+        c->next = arena->chunks;
+        arena->chunks = c;
+    }
+
+    elem = c->curr;
+    c->curr += sz;
 
     return(elem);
 }
 
 void
-array_pop_free(array_t* a, elem_t elem)
+arena_pop_free(arena_t* arena, elem_t elem)
 {
-    assert(SMRZR_FALSE == a->is_array);
+    chunk_t * c;
+
+    /* chunks pushed to after elem are emptied, their memory is kept as it
+       is till pushed to again */
+    while(NULL != (c = arena->chunks) &&
+          ((char*)elem < CHUNK_DATA(c) || (char*)elem >= c->curr)) {
+        arena->chunks = c->next;
+        c->next = arena->free;
+        arena->free = c;
+    }
 
-    assert(PTR_DIFF(elem, a) > 0 && PTR_DIFF(a->curr, elem) > 0);
+    assert(NULL != c);
 
-    a->curr = elem;
+    c->curr = (char*)elem;
 }
 
 relation_t
-comp_strings(const elem_t s1, const elem_t s2) /* char**, char* */
+comp_rule_with_word(const rule_t* rule, const char* word, size_t len)
 {
-    const char* a = *((const char**)s1);
-    const char* b = (const char*)s2;
-    int res;
+    /* both lowercase, so compared as bytes as far as the shorter goes */
+    int res = memcmp(RULE_FROM(rule), word,
+                     rule->from_len < len ? rule->from_len : len);
 
-    if(0 > (res = strcasecmp(a, b))) return(SMRZR_LT);
+    if(0 > res) return(SMRZR_LT);
     else if(0 < res) return(SMRZR_GT);
+    else if(rule->from_len < len) return(SMRZR_LT); /* 'from' is a prefix */
+    else if(rule->from_len > len) return(SMRZR_GT);
     else return(SMRZR_EQ);
 }
 
-relation_t
-comp_string_with_rule(const elem_t s1, const elem_t s2) /* char**, char* */
+int
+comp_raw_rules(const void* r1, const void* r2) /* char**, char** */
 {
-    const char* a = *((const char**)s1);
-    const char* b = (const char*)s2;
+    const char* a = *((const char**)r1);
+    const char* b = *((const char**)r2);
+    size_t a_len = strcspn(a, RULE_SEPARATOR_STR);
+    size_t b_len = strcspn(b, RULE_SEPARATOR_STR);
     int res;
 
-    size_t a_len = strlen(a), b_len = strcspn(b, RULE_SEPARATOR_STR);
+    if(0 != (res = strncasecmp(a, b, a_len < b_len ? a_len : b_len)))
+        return(res);
 
-    if(a_len < b_len) return(SMRZR_LT);
-    else if(a_len > b_len) return(SMRZR_GT);
-
-    if(0 > (res = strcasecmp(a, b))) return(SMRZR_LT);
-    else if(0 < res) return(SMRZR_GT);
-    else return(SMRZR_EQ);
+    return((int)a_len - (int)b_len);
 }
 
 relation_t
-comp_word_by_stem(const elem_t word_obj, const elem_t stem) /* word_t*, char* */
+comp_stems(const elem_t s1, const elem_t s2) /* char**, char* */
 {
-    const word_t* w = (const word_t*)word_obj;
-    const char* s = (const char*)stem;
+    const char* a = *((const char**)s1);
+    const char* b = (const char*)s2;
     int res;
 
-    if(0 > (res = strcasecmp(w->stem, s))) return(SMRZR_LT);
+    if(0 > (res = strcmp(a, b))) return(SMRZR_LT);
     else if(0 < res) return(SMRZR_GT);
     else return(SMRZR_EQ);
 }
@@ -856,6 +1763,7 @@ sentence_new(array_t** array, charpos_t begin)
 
     s->begin = begin;
     s->num_words = s->score = 0;
+    s->first_token = s->num_tokens = 0;
     s->is_para_begin = SMRZR_FALSE;
     s->is_selected = SMRZR_FALSE;
 
@@ -884,40 +1792,13 @@ array_alloc(array_t** array)
 }
 
 bool_t
-end_of_line(lang_t* lang, string_t word)
+end_of_line(const lang_t* lang, const char* word, size_t len)
 {
-    bool_t       res = SMRZR_FALSE;
-    string_t   * r;
-    size_t       word_len = strlen(word), rule_len;
-    array_t    * a;
-
-    a = lang->line_break;
-
-    for(r = (string_t*)ARR_FIRST(a); !ARR_END(a); r = (string_t*)ARR_NEXT(a)) {
-
-        rule_len = strlen(*r);
-
-        if(MATCH_AT_END(word, *r, word_len, rule_len)) {
-            res = SMRZR_TRUE;
-            break;
-        }
-    }
-
-    if(SMRZR_FALSE == res) return(res);
-
-    a = lang->line_dont_break;
-
-    for(r = (string_t*)ARR_FIRST(a); !ARR_END(a); r = (string_t*)ARR_NEXT(a)) {
-
-        rule_len = strlen(*r);
-
-        if(MATCH_AT_END(word, *r, word_len, rule_len)) {
-            res = SMRZR_FALSE;
-            break;
-        }
-    }
+    /* breaks if some line_break rule and no line_dont_break rule matches */
+    if(EOL_BREAK == trie_match_flags(lang->eol_set.trie, word, len))
+        return(SMRZR_TRUE);
 
-    return(res);
+    return(SMRZR_FALSE);
 }
 
 elem_t
@@ -980,19 +1861,32 @@ array_sorted_alloc(array_t** array, const elem_t key, compfunc_t cf)
     return(elem);
 }
 
-relation_t
-comp_sentence_by_score(const elem_t sen_obj, const elem_t score) /* sentence_t*, size_t */
+int
+comp_scored(const void* s1, const void* s2) /* scored_t*, scored_t* */
 {
-    const sentence_t* s = (const sentence_t*)sen_obj;
-    int res = s->score - (size_t)score;
+    const scored_t* a = (const scored_t*)s1;
+    const scored_t* b = (const scored_t*)s2;
 
-    if(0 > res) return(SMRZR_GT);
-    else if(0 < res) return(SMRZR_LT);
-    else return(SMRZR_EQ);
+    if(a->score != b->score) return(a->score > b->score ? -1 : 1);
+
+    return(a->index < b->index ? -1 : (a->index > b->index));
+}
+
+status_t
+stream_from_buffer(stream_t* stream, const char* buf, size_t len)
+{
+    /* words are spans, the buffer is only read */
+    stream->begin = (charpos_t)buf;
+    stream->len = len;
+    stream->map_len = 0;
+    stream->fd = -1;
+    stream->curr = stream->begin;
+
+    return(SMRZR_OK);
 }
 
 status_t
-stream_create(const char* file_name, stream_t* stream)
+stream_create(const char* file_name, stream_t* stream, bool_t is_writable)
 {
     int         fd;
     struct stat st;
@@ -1010,19 +1904,42 @@ stream_create(const char* file_name, stream_t* stream)
         ERROR_RET;
     }
 
-    /* mmap */
-    map_len = (1 + (st.st_size / PAGESIZE)) * PAGESIZE;
+    if(SMRZR_TRUE != is_writable && 0 == st.st_size) { /* nothing to map */
+        close(fd);
+        memset(stream, 0, sizeof(stream_t));
+        stream->begin = stream->curr = (charpos_t)"";
+        stream->fd = -1;
+        return(SMRZR_OK);
+    }
+
+    /* mmap, a writable stream with room for a terminator */
+    map_len = (SMRZR_TRUE == is_writable) ?
+              (1 + (st.st_size / PAGESIZE)) * PAGESIZE : (size_t)st.st_size;
 
     if(MAP_FAILED == (stream->begin =
-        mmap(NULL, map_len, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0)))
+        mmap(NULL, map_len, (SMRZR_TRUE == is_writable) ?
+             PROT_READ|PROT_WRITE : PROT_READ, MAP_PRIVATE, fd, 0)))
     {
         perror("Error in mmap'ing file: ");
         ERROR_RET;
     }
 
+    /* the terminator's page is past the end of a page-aligned file, where
+       the file's mapping can't be touched */
+    if(SMRZR_TRUE == is_writable && 0 == st.st_size % PAGESIZE &&
+       MAP_FAILED == mmap(stream->begin + st.st_size, PAGESIZE,
+                          PROT_READ|PROT_WRITE,
+                          MAP_PRIVATE|MAP_ANONYMOUS|MAP_FIXED, -1, 0))
+    {
+        perror("Error in mmap'ing end of file: ");
+        munmap(stream->begin, map_len);
+        ERROR_RET;
+    }
+
     stream->len = st.st_size;
     stream->map_len = map_len;
-    stream->begin[stream->len] = 0; /* null-terminated for token processing */
+    if(SMRZR_TRUE == is_writable)
+        stream->begin[stream->len] = 0; /* null-terminated for strsep */
     stream->fd = fd;
     stream->curr = stream->begin;
 
@@ -1089,6 +2006,17 @@ lang_destroy(lang_t* lang)
     array_free(lang->line_break);
     array_free(lang->line_dont_break);
     array_free(lang->exclude);
+
+    if(NULL != lang->dict)
+        munmap(lang->dict, lang->dict_map_len);
+
+    lang->dict = NULL;
+}
+
+void
+trie_free(trie_t* trie)
+{
+    free(trie);
 }
 
 void
@@ -1096,9 +2024,17 @@ article_destroy(article_t* article)
 {
     stream_destroy(&article->stream);
 
-    array_free(article->stack);
-    array_free(article->words);
+    arena_destroy(&article->stack);
+    array_free(article->stems);
+    array_free(article->counts);
+    array_free(article->weights);
+    hash_free(article->word_index);
+    array_free(article->tokens);
     array_free(article->sentences);
+    array_free(article->ranking);
+    array_free(article->terms);
+
+    free(article->owned_buf);
 }
 
 void
@@ -1106,9 +2042,15 @@ article_reset(article_t* article)
 {
     stream_destroy(&article->stream);
 
-    array_reset(article->stack);
-    array_reset(article->words);
+    arena_reset(&article->stack);
+    array_reset(article->stems);
+    array_reset(article->counts);
+    array_reset(article->weights);
+    hash_reset(article->word_index);
+    array_reset(article->tokens);
     array_reset(article->sentences);
+    array_reset(article->ranking);
+    array_reset(article->terms);
 
     article->num_words = 0;
 }
@@ -1117,12 +2059,114 @@ void
 stream_destroy(stream_t* stream)
 {
     if(NULL != stream->begin) {
-        close(stream->fd);
-        munmap(stream->begin, stream->map_len);
+        if(0 != stream->map_len) { /* not a caller's buffer */
+            close(stream->fd);
+            munmap(stream->begin, stream->map_len);
+        }
         memset(stream, 0, sizeof(stream_t));
     }
 }
 
+#if defined __SSE2__
+/* a bit for each of the 16 bytes at p that IS_SPACE, and in line_ends for
+   each that is \n or \r */
+static uint32_t
+space_mask(const char* p, uint32_t* line_ends)
+{
+    __m128i  v = _mm_loadu_si128((const __m128i*)p);
+    __m128i  ctl, space;
+
+    /* \t to \r are 0 to 4 unsigned once \t is taken off */
+    ctl = _mm_sub_epi8(v, _mm_set1_epi8('\t'));
+    ctl = _mm_cmpeq_epi8(_mm_min_epu8(ctl, _mm_set1_epi8('\r' - '\t')), ctl);
+
+    space = _mm_or_si128(_mm_or_si128(ctl, _mm_cmpeq_epi8(v, _mm_set1_epi8(' '))),
+                         _mm_cmpeq_epi8(v, _mm_setzero_si128()));
+
+    *line_ends = _mm_movemask_epi8(_mm_or_si128(
+                                   _mm_cmpeq_epi8(v, _mm_set1_epi8('\n')),
+                                   _mm_cmpeq_epi8(v, _mm_set1_epi8('\r'))));
+
+    return(_mm_movemask_epi8(space));
+}
+#endif
+
+/* Past the spaces at p, noting if a line ended among them. Whole blocks of
+   16 bytes are classified at once, the bytes left before end one by one, so
+   nothing past end is read. */
+charpos_t
+stream_skip_space(charpos_t p, charpos_t end, bool_t* is_line_end)
+{
+#if defined __SSE2__
+    uint32_t  space, line_ends, text;
+
+    while(end - p >= 16) {
+        space = space_mask(p, &line_ends);
+
+        if(0 != (text = ~space & 0xffff)) {
+            /* only the line ends before the text count */
+            line_ends &= (text & (~text + 1)) - 1;
+            if(NULL != is_line_end && 0 != line_ends)
+                *is_line_end = SMRZR_TRUE;
+            return(p + __builtin_ctz(text));
+        }
+
+        if(NULL != is_line_end && 0 != line_ends)
+            *is_line_end = SMRZR_TRUE;
+
+        p += 16;
+    }
+#endif
+
+    while(p < end && IS_SPACE(*p)) {
+        if(NULL != is_line_end && ('\n' == *p || '\r' == *p))
+            *is_line_end = SMRZR_TRUE;
+        ++p;
+    }
+
+    return(p);
+}
+
+/* The end of the word at word, and past the spaces after it, the next one.
+   A word and the spaces after it mostly fit in the same 16 bytes, which are
+   then classified once for both. */
+charpos_t
+stream_next_word(charpos_t word, charpos_t end, charpos_t* word_end,
+                 bool_t* is_line_end)
+{
+    charpos_t p = word;
+#if defined __SSE2__
+    uint32_t  space, line_ends, text;
+
+    while(end - p >= 16) {
+        if(0 == (space = space_mask(p, &line_ends))) {
+            p += 16;
+            continue;
+        }
+
+        *word_end = p + __builtin_ctz(space);
+
+        /* text after the first space starts the next word; line ends can
+           only be spaces, so are all after the first one */
+        if(0 != (text = ~space & 0xffff & ~((space & (~space + 1)) - 1))) {
+            line_ends &= (text & (~text + 1)) - 1;
+            if(0 != line_ends) *is_line_end = SMRZR_TRUE;
+            return(p + __builtin_ctz(text));
+        }
+
+        if(0 != line_ends) *is_line_end = SMRZR_TRUE;
+
+        return(stream_skip_space(p + 16, end, is_line_end));
+    }
+#endif
+
+    while(p < end && !IS_SPACE(*p)) ++p;
+
+    *word_end = p;
+
+    return(stream_skip_space(p, end, is_line_end));
+}
+
 void
 array_free(array_t* array)
 {
@@ -1134,3 +2178,19 @@ array_reset(array_t* array)
 {
     array->curr = PTR_ADD(elem_t, array, sizeof(array_t));
 }
+
+void
+hash_free(hash_t* hash)
+{
+    free(hash);
+}
+
+void
+hash_reset(hash_t* hash)
+{
+    /* keep the grown table around for the next article */
+    if(0 != hash->num_used) {
+        memset(HASH_SLOTS(hash), 0, hash->num_slots * sizeof(slot_t));
+        hash->num_used = 0;
+    }
+}
@@ -0,0 +1,163 @@
+/*
+ * stemtest.c
+ */
+
+#include "header.h"
+
+/* MACROS */
+
+#define LINE_MAX_SZ  4096
+
+/* FUNCTIONS */
+
+static void usage(const char* prog);
+static status_t stem_file(const char* file_name, const lang_t* lang,
+                          arena_t* stack, FILE* golden, size_t* num_diffs);
+
+int
+main(int argc, char** argv)
+{
+    lang_t     lang;
+    arena_t    stack;
+    status_t   status;
+    FILE     * golden = NULL;
+    char       line[LINE_MAX_SZ];
+    int        opt, i;
+    literal_t  xml_name = DICTIONARY_DIR"/en.xml", golden_name = NULL;
+    size_t     num_diffs = 0;
+
+    while(-1 != (opt = getopt(argc, argv, "d:g:h"))) {
+        switch(opt) {
+            case 'd': xml_name = optarg; break;
+            case 'g': golden_name = optarg; break;
+            case 'h': usage(argv[0]); return(0);
+            default: usage(argv[0]); return(1);
+        }
+    }
+
+    if(optind == argc) {
+        fprintf(stderr, "No input file specified\n");
+        usage(argv[0]);
+        return(1);
+    }
+
+    if(NULL != golden_name && NULL == (golden = fopen(golden_name, "r"))) {
+        perror("Error in opening golden file: ");
+        return(1);
+    }
+
+    arena_init(&stack, SMRZR_FALSE);
+
+    status =
+        init_globals() ||
+
+        lang_init(&lang) ||
+
+        parse_lang_xml(xml_name, &lang);
+
+    for(i = optind; SMRZR_OK == status && i < argc; ++i)
+        status = stem_file(argv[i], &lang, &stack, golden, &num_diffs);
+
+    /* the golden file has no more words than the inputs */
+    if(SMRZR_OK == status && NULL != golden &&
+       NULL != fgets(line, sizeof(line), golden))
+    {
+        fprintf(stderr, "Golden file has more words than the inputs\n");
+        ++num_diffs;
+    }
+
+    if(NULL != golden) fclose(golden);
+
+    arena_destroy(&stack);
+
+    lang_destroy(&lang);
+
+    if(SMRZR_OK == status && 0 != num_diffs)
+        fprintf(stderr, "%lu words stemmed differently\n", num_diffs);
+
+    return(SMRZR_OK == status && 0 == num_diffs ? 0 : 1);
+}
+
+void usage(const char* prog)
+{
+    fprintf(stderr, "Usage: %s [-d <dictionary-xml>] [-g <golden-file>] <input-file> ...\n", prog);
+    fprintf(stderr, "Usage: %s -h\n\n", prog);
+    fprintf(stderr, "dictionary-xml : the language rules [%s]\n",
+            DICTIONARY_DIR"/en.xml");
+    fprintf(stderr, "   golden-file : word, core and stem of each word of the\n"
+                    "                 inputs, as printed without -g; any word\n"
+                    "                 stemmed differently fails\n");
+    fprintf(stderr, "    input-file : words are split from it as from articles\n");
+    fprintf(stderr, "            -h : print this help\n");
+}
+
+status_t
+stem_file(const char* file_name, const lang_t* lang, arena_t* stack,
+          FILE* golden, size_t* num_diffs)
+{
+    stream_t    stream;
+    string_t    word, word_core, word_stem;
+    char        core[LINE_MAX_SZ], line[LINE_MAX_SZ], expected[LINE_MAX_SZ];
+    size_t      word_len, line_no = 0;
+    bool_t      is_proper, is_line_end;
+    int         len;
+
+    if(SMRZR_OK != stream_create(file_name, &stream, SMRZR_FALSE))
+        ERROR_RET;
+
+    while(!STREAM_END(&stream)) {
+
+        STREAM_FIND_WORD(&stream);
+
+        if(STREAM_END(&stream)) break;
+
+        STREAM_GET_WORD(&stream, word, word_len, is_line_end);
+
+        /* each word is stemmed as parse_article_stream does it */
+        if(NULL == (word_core = get_word_core(stack, lang, word, word_len,
+                                              &is_proper)))
+        {
+            stream_destroy(&stream);
+            ERROR_RET;
+        }
+
+        snprintf(core, sizeof(core), "%s", word_core);
+
+        if(NULL == (word_stem = get_word_stem(stack, lang, word_core,
+                                              is_proper)))
+        {
+            stream_destroy(&stream);
+            ERROR_RET;
+        }
+
+        len = snprintf(line, sizeof(line), "%.*s\t%s\t%s\n", (int)word_len,
+                       word, core, word_stem);
+        if(len >= (int)sizeof(line)) len = sizeof(line) - 1;
+
+        arena_reset(stack);
+
+        ++line_no;
+
+        if(NULL == golden) {
+            fwrite(line, 1, len, stdout);
+            continue;
+        }
+
+        if(NULL == fgets(expected, sizeof(expected), golden)) {
+            fprintf(stderr, "%s: golden file ends before word %lu\n",
+                    file_name, line_no);
+            ++(*num_diffs);
+            break;
+        }
+
+        if(strcmp(line, expected)) {
+            fprintf(stderr, "%s: word %lu\n  expected %s  got      %s",
+                    file_name, line_no, expected, line);
+            ++(*num_diffs);
+        }
+    }
+
+    stream_destroy(&stream);
+
+    return(SMRZR_OK);
+}
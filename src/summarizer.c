@@ -4,10 +4,17 @@
 
 #include "header.h"
 
+/* MACROS */
+
+#define MAX_RATIOS  16
+
 /* FUNCTIONS */
 
 static void print_summary(article_t* article);
+static void print_ranking(article_t* article);
+static void print_terms(article_t* article);
 static void usage(const char* prog);
+static status_t parse_article_stdin(const lang_t* lang, article_t* article);
 
 int
 main(int argc, char** argv)
@@ -17,12 +24,28 @@ main(int argc, char** argv)
     status_t   status;
     int        opt;
     literal_t  file_name = NULL;
-    float      ratio = 0.0;
+    float      ratios[MAX_RATIOS];
+    int        num_ratios = 0, i;
+    bool_t     is_ranking = SMRZR_FALSE;
+    int        num_terms = -1; /* none unless asked for, 0 for all */
 
-    while(-1 != (opt = getopt(argc, argv, "i:r:h"))) {
+    while(-1 != (opt = getopt(argc, argv, "i:r:Rk:h"))) {
         switch(opt) {
             case 'i': file_name = optarg; break;
-            case 'r': ratio = atof(optarg)/100; break;
+            case 'r':
+                if(MAX_RATIOS == num_ratios) {
+                    fprintf(stderr, "At most %d ratios supported\n", MAX_RATIOS);
+                    return(1);
+                }
+                ratios[num_ratios++] = atof(optarg)/100;
+                break;
+            case 'R': is_ranking = SMRZR_TRUE; break;
+            case 'k':
+                if(0 > (num_terms = atoi(optarg))) {
+                    fprintf(stderr, "Number of terms cannot be negative\n");
+                    return(1);
+                }
+                break;
             case 'h': usage(argv[0]); return(0);
             default: usage(argv[0]); return(1);
         }
@@ -34,12 +57,20 @@ main(int argc, char** argv)
         return(1);
     }
 
-    if(0.0 == ratio) {
-        fprintf(stderr, "Ratio cannot be 0.0\n");
+    if(0 == num_ratios && SMRZR_TRUE != is_ranking && 0 > num_terms) {
+        fprintf(stderr, "No ratio specified\n");
         usage(argv[0]);
         return(1);
     }
 
+    for(i = 0; i < num_ratios; ++i) {
+        if(0.0 == ratios[i]) {
+            fprintf(stderr, "Ratio cannot be 0.0\n");
+            usage(argv[0]);
+            return(1);
+        }
+    }
+
     status =
         init_globals() ||
 
@@ -47,13 +78,37 @@ main(int argc, char** argv)
 
         parse_lang_xml(DICTIONARY_DIR"/en.xml", &lang) ||
 
-        article_init(&article) ||
+        article_init(&article, SMRZR_FALSE) ||
 
-        parse_article(file_name, &lang, &article) ||
+        (strcmp(file_name, "-") ?
+         parse_article(file_name, &lang, &article) :
+         parse_article_stdin(&lang, &article)) ||
+
+        rank_article(&article, &lang);
+
+    /* ranked once, then each ratio just selects from the ranking */
+    for(i = 0; SMRZR_OK == status && i < num_ratios; ++i) {
+
+        if(1 < num_ratios)
+            fprintf(stdout, "%s== %g%% ==\n", i ? "\n" : "", ratios[i] * 100);
+
+        select_sentences(&article, ratios[i]);
+        print_summary(&article);
+    }
 
-        grade_article(&article, &lang, ratio);
+    if(SMRZR_OK == status && SMRZR_TRUE == is_ranking) {
+        if(0 < num_ratios)
+            fprintf(stdout, "\n== ranking ==\n");
+        print_ranking(&article);
+    }
 
-    print_summary(&article);
+    /* counted in the same parse as the summaries */
+    if(SMRZR_OK == status && 0 <= num_terms &&
+       SMRZR_OK == (status = rank_terms(&article, num_terms))) {
+        if(0 < num_ratios || SMRZR_TRUE == is_ranking)
+            fprintf(stdout, "\n== terms ==\n");
+        print_terms(&article);
+    }
 
     article_destroy(&article);
 
@@ -64,19 +119,62 @@ main(int argc, char** argv)
 
 void usage(const char* prog)
 {
-    fprintf(stderr, "Usage: %s -i <input-file> -r <ratio>\n", prog);
+    fprintf(stderr, "Usage: %s -i <input-file> -r <ratio> [-r <ratio> ...] [-R] [-k <count>]\n", prog);
     fprintf(stderr, "Usage: %s -h\n\n", prog);
-    fprintf(stderr, "input-file : the file to summarize\n");
-    fprintf(stderr, "     ratio : indicated using a percentage (without %%) sign\n");
+    fprintf(stderr, "input-file : the file to summarize, - for standard input\n");
+    fprintf(stderr, "     ratio : indicated using a percentage (without %%) sign,\n"
+                    "             up to %d of them, each printing its summary\n", MAX_RATIOS);
+    fprintf(stderr, "        -R : print every sentence, best first, as its index and\n"
+                    "             word count\n");
+    fprintf(stderr, "     count : -k prints that many word stems, most occurring first,\n"
+                    "             with their counts; 0 for all of them\n");
     fprintf(stderr, "        -h : print this help\n");
 }
 
+status_t
+parse_article_stdin(const lang_t* lang, article_t* article)
+{
+#define STDIN_READ_SZ  65536
+
+    string_t    buf = NULL, grown;
+    size_t      len = 0, sz = 0;
+    ssize_t     n;
+
+    /* read into our own buffer, which is then summarized */
+    do {
+        if(len + STDIN_READ_SZ + 1 > sz) {
+            sz = 2 * sz + STDIN_READ_SZ + 1;
+            if(NULL == (grown = (string_t)realloc(buf, sz))) {
+                free(buf);
+                ERROR_RET;
+            }
+            buf = grown;
+        }
+
+        if(0 > (n = read(STDIN_FILENO, buf + len, STDIN_READ_SZ))) {
+            if(EINTR == errno) continue;
+            perror("Error in reading standard input: ");
+            free(buf);
+            ERROR_RET;
+        }
+
+        len += n;
+    } while(0 != n);
+
+    /* its sentences point into it, so the article keeps it */
+    free(article->owned_buf);
+    article->owned_buf = buf;
+
+    return(parse_article_buffer(buf, len, lang, article));
+}
+
 void
 print_summary(article_t* article)
 {
     array_t     * a;
     sentence_t  * s;
     string_t      w;
+    size_t        len;
 
     PROF_START;
 
@@ -90,18 +188,54 @@ print_summary(article_t* article)
 
             w = s->begin;
 
+            /* the words as in the article, a space after each */
             while(w < s->end) {
 
-                while(0 == *w && w < s->end) ++w;
+                while(w < s->end && IS_SPACE(*w)) ++w;
 
                 if(w >= s->end) break;
 
-                fprintf(stdout, "%s ", w);
+                for(len = 0; w + len < s->end && !IS_SPACE(w[len]); ++len)
+                    ;
+
+                fwrite(w, 1, len, stdout);
+                fputc(' ', stdout);
 
-                w = w + strlen(w);
+                w = w + len;
             }
         }
     }
 
     PROF_END("summary output");
 }
+
+void
+print_ranking(article_t* article)
+{
+    array_t     * a;
+    sentence_t  * sentences;
+    uint32_t    * rank;
+
+    sentences = (sentence_t*)ARR_AT(article->sentences, 0);
+
+    a = article->ranking;
+
+    for(rank=(uint32_t*)ARR_FIRST(a); !ARR_END(a); rank=(uint32_t*)ARR_NEXT(a))
+        fprintf(stdout, "%u %lu\n", *rank, sentences[*rank].num_words);
+}
+
+void
+print_terms(article_t* article)
+{
+    array_t     * a;
+    string_t    * stems;
+    uint32_t    * counts, * term;
+
+    stems = (string_t*)ARR_AT(article->stems, 0);
+    counts = (uint32_t*)ARR_AT(article->counts, 0);
+
+    a = article->terms;
+
+    for(term=(uint32_t*)ARR_FIRST(a); !ARR_END(a); term=(uint32_t*)ARR_NEXT(a))
+        fprintf(stdout, "%s %u\n", stems[*term], counts[*term]);
+}
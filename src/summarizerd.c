@@ -2,12 +2,18 @@
  * summarizer.c
  */
 
+#define _GNU_SOURCE /* cpu affinity */
 #include "header.h"
+#include <sched.h>
 #include <sys/wait.h>
 #include <signal.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
-#include <sys/select.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/uio.h>
+#include <sys/inotify.h>
 #include <pthread.h>
 #include "daemon.h"
 
@@ -16,13 +22,47 @@
 #define DEFAULT_LOG_FILE      "/var/log/summarizerd.log"
 #define DEFAULT_PID_FILE      "/var/log/summarizerd.pid"
 #define DEFAULT_LOG_LEVEL     LL_ERROR
-#define DEFAULT_CLIENTS       32
-#define MAX_CLIENTS           32
-#define DEFAULT_WORKERS       4
-#define MAX_WORKERS           4
-#define CLIENT_WAIT_TIME      500000 /* 0.5s */
+#define DEFAULT_CLIENTS       SOMAXCONN
+#define MAX_CLIENTS           65535
+#define DEFAULT_WORKERS       1
+#define MAX_WORKERS           1024
+#define DEFAULT_COMPUTERS     0 /* one per online cpu */
+#define MAX_COMPUTERS         1024
 #define MAX_STACK_SIZE        65536
-#define EXPECTED_CLI_PER_WORKER  DEFAULT_CLIENTS
+#define MAX_SOCKS             65536 /* connections, as fds */
+#define MAX_EVENTS            64
+#define MAX_INFLIGHT          64 /* version 3-5 requests per connection */
+#define DEFAULT_CACHE_BYTES   (32UL << 20) /* of summaries of version 1 files */
+#define DEFAULT_ANALYSIS_BYTES (64UL << 20) /* of parsed version 1 files */
+#define CACHE_BUCKETS         4096 /* power of 2 */
+#define WATCH_EVENTS          (IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | \
+                               IN_MOVE_SELF | IN_DELETE_SELF)
+
+/* replies may go out of order, so more may be read meanwhile */
+#define IS_PIPELINED(ver) \
+  (SUMMARIZERD_VERSION_TAGGED == (ver) || SUMMARIZERD_VERSION_BATCH == (ver) || \
+   SUMMARIZERD_VERSION_RANKED == (ver))
+
+/* replies framed as those to batch items, with an index */
+#define IS_INDEXED(ver) \
+  (SUMMARIZERD_VERSION_BATCH == (ver) || SUMMARIZERD_VERSION_RANKED == (ver))
+
+#define MAX_RANKED_LEN \
+  (MAX_DOCUMENT_LEN + sizeof(ranked_header_t) + \
+   (MAX_RANKED_RATIOS + 1) * sizeof(uint32_t))
+
+/* load counters are read by other threads without a lock; each has one
+   writer at a time, the owning thread or whoever holds the worker's lock */
+#define COUNTER_GET(c)     __atomic_load_n(&(c), __ATOMIC_RELAXED)
+#define COUNTER_SET(c, v)  __atomic_store_n(&(c), (v), __ATOMIC_RELAXED)
+#define COUNTER_ADD(c, v)  COUNTER_SET(c, COUNTER_GET(c) + (v))
+#define COUNTER_SUB(c, v)  COUNTER_SET(c, COUNTER_GET(c) - (v))
+
+/* a socket slot changes hands when its fd is closed and accepted again, and
+   a worker may still look at it for an event from before; sock is set last
+   and cleared first, so whoever sees it set sees the rest of the slot */
+#define SLOT_GET(f)        __atomic_load_n(&(f), __ATOMIC_ACQUIRE)
+#define SLOT_SET(f, v)     __atomic_store_n(&(f), (v), __ATOMIC_RELEASE)
 
 #define TERMSIGCASES   case SIGTERM: case SIGINT: case SIGKILL: case SIGUSR1
 #define CRASHSIGCASES  case SIGABRT: case SIGSEGV: case SIGILL: case SIGFPE: case SIGBUS: case SIGQUIT
@@ -53,27 +93,156 @@ typedef enum {
     PROTO_INTERNAL_ERROR = -6
 } proto_status_t;
 
-typedef enum {
-    SOCK_READ = 0,
-    SOCK_WRITE
-} sock_status_t;
-
+/* a summary of a file, as last stat'ed, for a ratio */
 typedef struct {
+    dev_t              dev;
+    ino_t              ino;
+    struct timespec    mtime;
+    off_t              size;
+    uint32_t           ratio; /* as received */
+} cache_key_t;
+
+typedef struct analysis_s analysis_t;
+
+typedef struct request_s request_t;
+
+/* a request from when it is read till its reply is sent */
+struct request_s {
+    request_t        * next; /* in the job queue, a done list or a reply list */
     int                sock;
-    int                req_offset;
-    request_header_t   reqhdr;
+    request_header_t   reqhdr; /* of the item, for one in a batch */
+    uint32_t           id; /* version 3-5 only */
+    uint32_t           index; /* in the batch, version 4 only */
+    request_t        * batch; /* holding the document of an item */
+    int                refs; /* items of a batch hold one each */
     response_type_t    rep_type;
-    sock_status_t      status;
-    char               filename[MAX_FILENAME_LEN];
+    string_t           payload; /* filename, document or batch, null-terminated */
+    size_t             payload_sz;
+    string_t           doc; /* to summarize, in the payload or the batch's */
+    size_t             load; /* bytes counted in the owner's load */
+    bool_t             loaded; /* counted in the owner's load */
+    uint64_t           queued_at; /* usecs */
+    string_t           reply; /* summary rendered by the compute thread */
+    cache_key_t        key; /* of the file, version 1 only */
+    bool_t             cacheable; /* key is set, the summary may be cached */
+    analysis_t       * analysis; /* of the file, to select from, held */
+    size_t             reply_len, reply_sz;
+    batch_response_header_t rephdr; /* room for any reply header */
+    size_t             rephdr_len;
+    size_t             rep_len; /* header and summary, 0 till prepared */
+    size_t             rep_offset; /* sent so far */
+};
+
+typedef struct {
+    int                sock; /* see SLOT_GET */
+    int                worker; /* owner, once it polls the socket */
+    int                next_pending; /* next sock handed to the same worker */
+    request_t        * in; /* being read */
+    size_t             req_offset;
+    request_t        * out_head, * out_tail; /* replies, as they complete */
+    request_t        * spare; /* kept for its buffers */
+    int                num_inflight; /* read, not replied to yet */
+    int                num_computing; /* of those, with compute threads */
+    bool_t             serial; /* version 1/2 request in flight, no more */
+    bool_t             closing; /* peer gone, waiting for the computing */
 } sock_context_t;
 
+/* load counters are only written by the worker (pending ones under its
+   lock), others read them as hints to spread the load, see COUNTER_GET */
 typedef struct {
-    pthread_mutex_t    mutex;
-    pthread_cond_t     cond;
-    array_t          * sock_contexts;
-    int                max_fds;
+    int                id;
+    int                epoll_fd;
+    int                wake_fd; /* readable when handed sockets */
+    int                cpu; /* pinned to, -1 if not */
+    pthread_t          thread;
+    pthread_mutex_t    lock; /* guards the pending and done lists */
+    int                pending_head, pending_tail; /* socks not polled yet */
+    request_t        * done_head, * done_tail; /* summarized requests */
+    size_t             num_pending;
+    size_t             num_socks; /* being polled */
+    size_t             num_busy; /* requests read, not yet replied to */
+    size_t             busy_bytes; /* documents of those requests */
+    size_t             num_served;
+    size_t             num_stolen; /* sockets taken from busy workers */
 } worker_context_t;
 
+/* summarizes for the workers, which only read requests and write replies */
+typedef struct {
+    int                id;
+    int                cpu; /* pinned to, -1 if not */
+    pthread_t          thread;
+    size_t             num_jobs;
+} computer_context_t;
+
+/* requests read in full, for the compute threads */
+typedef struct {
+    pthread_mutex_t    lock;
+    pthread_cond_t     ready;
+    request_t        * head, * tail;
+    bool_t             quitting;
+    size_t             depth, max_depth;
+    size_t             num_taken;
+    uint64_t           wait_us, max_wait_us; /* from queued to taken */
+} job_queue_t;
+
+typedef struct cache_entry_s cache_entry_t;
+
+struct cache_entry_s {
+    cache_entry_t    * hnext; /* in its bucket */
+    cache_entry_t    * prev, * next; /* most recently used first */
+    cache_key_t        key;
+    string_t           summary; /* follows the entry */
+    size_t             len;
+};
+
+/* rendered summaries of version 1 files, shared by the workers, which look
+   them up, and the compute threads, which add them */
+typedef struct {
+    pthread_mutex_t    lock;
+    cache_entry_t   ** buckets;
+    cache_entry_t    * head, * tail;
+    size_t             num_entries;
+    size_t             bytes, budget; /* 0 budget = no caching */
+    size_t             hits, misses;
+    size_t             stale; /* found with the file changed */
+    size_t             evicted;
+} summary_cache_t;
+
+/* a sentence of an analysis, as rendered in a summary */
+typedef struct {
+    size_t             offset; /* into the text */
+    size_t             len;
+    size_t             num_words;
+} analyzed_sentence_t;
+
+/* a version 1 file as parsed and ranked, to select summaries of any ratio
+   from; dropped when the file changes, freed once no request holds it */
+struct analysis_s {
+    analysis_t       * hnext; /* in its bucket */
+    analysis_t       * prev, * next; /* most recently used first */
+    cache_key_t        key; /* ratio unused */
+    int                wd; /* inotify watch on the file, -1 if none */
+    int                refs; /* the cache's and requests' */
+    size_t             size; /* counted in the budget */
+    size_t             num_words;
+    size_t             num_sentences;
+    analyzed_sentence_t* sentences; /* follow the entry, then the ranking */
+    uint32_t         * ranking; /* best first */
+    string_t           text; /* all sentences, after the ranking */
+};
+
+typedef struct {
+    pthread_mutex_t    lock; /* guards the entries' refs too */
+    analysis_t      ** buckets;
+    analysis_t       * head, * tail;
+    size_t             num_entries;
+    size_t             bytes, budget; /* 0 budget = no caching */
+    size_t             hits, misses;
+    size_t             stale; /* found with the file changed */
+    size_t             evicted;
+    size_t             dropped; /* on inotify events */
+} analysis_cache_t;
+
 /* GLOBALS */
 
 static uint16_t   g_port = SUMMARIZERD_PORT;
@@ -83,6 +252,9 @@ static bool_t     g_is_daemon = SMRZR_TRUE;
 static literal_t  g_pid_file = DEFAULT_PID_FILE;
 static int        g_pid_fd = -1;
 static int        g_num_workers = DEFAULT_WORKERS;
+static int        g_num_computers = DEFAULT_COMPUTERS;
+static bool_t     g_pin_workers = SMRZR_FALSE;
+static bool_t     g_huge_pages = SMRZR_FALSE;
 
 static FILE*      g_log;
 
@@ -93,14 +265,36 @@ static int        g_main_sock = -1;
 static pid_t      g_pid;
 static int        g_err = 0, g_exiting = 0, g_to_fork = 0, g_to_exit = 0;
 
-static worker_context_t g_worker_contexts[MAX_WORKERS] = {
-    { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL, 0 },
-    { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL, 0 },
-    { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL, 0 },
-    { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL, 0 }
+static worker_context_t * g_worker_contexts;
+static int              g_num_started = 0;
+
+static computer_context_t * g_computer_contexts;
+static int              g_num_computers_started = 0;
+
+static job_queue_t      g_jobs = {
+    PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL, NULL, SMRZR_FALSE,
+    0, 0, 0, 0, 0
+};
+
+static summary_cache_t  g_cache = {
+    PTHREAD_MUTEX_INITIALIZER, NULL, NULL, NULL, 0, 0, DEFAULT_CACHE_BYTES,
+    0, 0, 0, 0
+};
+
+static analysis_cache_t g_analyses = {
+    PTHREAD_MUTEX_INITIALIZER, NULL, NULL, NULL, 0, 0, DEFAULT_ANALYSIS_BYTES,
+    0, 0, 0, 0, 0
 };
 
-static pthread_t        g_workers[MAX_WORKERS];
+static int              g_watch_fd = -1; /* inotify, for the analyzed files */
+
+/* connection state indexed by fd, owned by the worker polling the fd */
+static sock_context_t * g_socks;
+static int              g_max_socks = 0;
+
+static int              g_quit_fd = -1; /* readable once quitting */
+
+static lang_t           g_lang; /* read-only, shared by all workers */
 
 static const char* g_level_strs[] = {
     "none    ", /* LL_NONE = 0 */
@@ -128,26 +322,80 @@ static void main_proc(void);
 static void check_existing_process(void);
 static void handle_io_streams(void);
 static void register_pid(void);
+static void init_socks(void);
 static void init_workers(void);
+static void init_computers(void);
+static void pin_workers(void);
+static void init_cache(void);
+static void destroy_cache(void);
+static bool_t cache_lookup(request_t* req);
+static bool_t summary_lookup(request_t* req);
+static void cache_insert(const request_t* req);
+static void cache_remove(cache_entry_t* e);
+static size_t cache_bucket(const cache_key_t* key);
+static bool_t stat_key(literal_t file, uint32_t ratio, cache_key_t* key);
+static bool_t same_file(const cache_key_t* a, const cache_key_t* b);
+static bool_t file_unchanged(const request_t* req);
+static void init_analyses(void);
+static void destroy_analyses(void);
+static analysis_t* analysis_lookup(const request_t* req);
+static void analysis_insert(const request_t* req, article_t* article);
+static void analysis_remove(analysis_t* a);
+static void analysis_release(analysis_t* a);
+static void analysis_unref(analysis_t* a);
+static size_t analysis_bucket(const cache_key_t* key);
+static status_t render_analysis(request_t* req, float ratio);
+static size_t render_sentence(const sentence_t* sent, string_t out);
+static void handle_watch_events(void);
+static void drop_watched(int wd, bool_t is_watched);
 static int  file_lock_ex(int);
 static void setup_socket(void);
 static void quit(int);
 static int  file_lock_un(int);
 static int  handle_accept_nb(void);
 static int  assign_to_worker(int sock);
+static int  pick_worker(void);
+static void wake_worker(worker_context_t*);
+static int  adopt_pending(worker_context_t* ctxt, worker_context_t* from);
+static void steal_pending(worker_context_t* ctxt);
+static request_t* new_request(sock_context_t* s);
+static void release_request(sock_context_t* s, request_t* req);
+static void free_requests(request_t* req);
+static void start_request(sock_context_t* s, request_t* req);
+static void split_batch(sock_context_t* s, request_t* batch);
+static int  check_batch(const request_t* batch);
+static int  check_ranked(request_t* req);
+static void begin_request(sock_context_t* s, request_t* req);
+static void end_request(sock_context_t* s, request_t* req, bool_t served);
+static void log_worker_loads(void);
 static void* worker(void*);
 static void initiate_quit(int);
-static int  worker_loop(worker_context_t*, lang_t*, article_t*);
+static int  worker_loop(worker_context_t*);
+static int  serve_sock(sock_context_t* s);
+static int  send_replies(sock_context_t* s);
+static void queue_reply(sock_context_t* s, request_t* req);
+static void queue_job(request_t* req);
+static int  finish_jobs(worker_context_t* ctxt);
+static void* computer(void*);
+static void computer_loop(computer_context_t*, const lang_t*, article_t*);
+static void summarize(request_t* req, const lang_t*, article_t*);
+static status_t render_summary(request_t* req, article_t*);
+static status_t render_ranked(request_t* req, article_t*);
+static status_t render_terms(request_t* req, article_t*);
+static status_t reserve_reply(request_t* req, size_t len);
+static uint64_t now_usec(void);
+static int  write_response(request_t* req);
 static int  read_summary_request(sock_context_t* ctxt);
 static int  read_nb(int sock, void* buf, size_t len);
-static int  write_summary_response(int sock, article_t*);
-static int  write_error_response(int sock, int err);
-static int  write_nb(int sock, const void* buf, size_t len);
-static int  handle_select_error(void);
-static int  handle_read_error(int, worker_context_t*, sock_context_t*);
-static int  handle_write_error(int, worker_context_t*, sock_context_t*);
-static int  close_peer(worker_context_t *ctxt, int sock);
-static relation_t comp_sock_context(const elem_t, const elem_t);
+static uint16_t response_version(const request_t* req);
+static void prepare_summary_response(request_t* req);
+static void prepare_error_response(request_t* req);
+static int  write_nb(int sock, struct iovec* iov, int iovcnt);
+static int  handle_wait_error(void);
+static int  handle_read_error(int, sock_context_t*);
+static int  handle_write_error(int, sock_context_t*);
+static int  close_peer(sock_context_t* s);
+static void release_sock(sock_context_t* s);
 
 /* FUNCTIONS */
 
@@ -163,7 +411,7 @@ main(int argc, char** argv)
         usage(argv[0]);
     }
 
-    while(-1 != (opt = getopt(argc, argv, "l:p:v:n:i:w:fh"))) {
+    while(-1 != (opt = getopt(argc, argv, "l:p:v:n:i:w:c:m:M:aHfh"))) {
         switch(opt) {
             case 'l': log_file = optarg; break;
             case 'v': g_log_level = (loglevel_t)atoi(optarg); break;
@@ -172,6 +420,11 @@ main(int argc, char** argv)
             case 'i': g_pid_file = optarg; break;
             case 'f': g_is_daemon = SMRZR_FALSE; break;
             case 'w': g_num_workers = atoi(optarg); break;
+            case 'c': g_num_computers = atoi(optarg); break;
+            case 'm': g_cache.budget = strtoul(optarg, NULL, 10); break;
+            case 'M': g_analyses.budget = strtoul(optarg, NULL, 10); break;
+            case 'a': g_pin_workers = SMRZR_TRUE; break;
+            case 'H': g_huge_pages = SMRZR_TRUE; break;
             case 'h': usage(argv[0]);
             default: usage(argv[0]);
         }
@@ -194,8 +447,20 @@ main(int argc, char** argv)
         usage(argv[0]);
     }
 
+    if(g_num_computers > MAX_COMPUTERS) {
+        fprintf(stderr, "Maximum %d compute threads supported, suggested %u\n",
+                        MAX_COMPUTERS, g_num_computers);
+        usage(argv[0]);
+    }
+
     if(!g_num_cli)      g_num_cli     = DEFAULT_CLIENTS;
-    if(!g_num_workers)  g_num_workers = DEFAULT_WORKERS;
+    if(g_num_workers <= 0) g_num_workers = DEFAULT_WORKERS;
+    if(g_num_computers <= 0) { /* use the whole machine */
+        if(0 >= (g_num_computers = sysconf(_SC_NPROCESSORS_ONLN)))
+            g_num_computers = 1;
+        if(g_num_computers > MAX_COMPUTERS)
+            g_num_computers = MAX_COMPUTERS;
+    }
     if(!g_port)         g_port        = SUMMARIZERD_PORT;
     if(!g_pid_file)     g_pid_file    = DEFAULT_PID_FILE;
     if(!log_file)       log_file      = DEFAULT_LOG_FILE;
@@ -206,8 +471,13 @@ main(int argc, char** argv)
     }
 
     LOG(LL_INFO, "Summarizer Daemon Config: logfile '%s', logging level '%d', "
-                 "port '%u', clients listened '%u', daemon mode '%s'",
-        log_file, g_log_level, g_port, g_num_cli,
+                 "port '%u', clients listened '%u', workers '%d', "
+                 "compute threads '%d', pinned '%s', cache bytes '%lu', "
+                 "analysis bytes '%lu', huge pages '%s', daemon mode '%s'",
+        log_file, g_log_level, g_port, g_num_cli, g_num_workers,
+        g_num_computers,
+        ((SMRZR_TRUE == g_pin_workers) ? "Y" : "N"), g_cache.budget,
+        g_analyses.budget, ((SMRZR_TRUE == g_huge_pages) ? "Y" : "N"),
         ((SMRZR_TRUE == g_is_daemon) ? "Y" : "N"));
 
     /* Do the initial inits common to all children */
@@ -217,6 +487,13 @@ main(int argc, char** argv)
         return(1);
     }
 
+    /* language rules are read-only, children share the parent's copy */
+    status = lang_init(&g_lang) || parse_lang_xml(DICTIONARY_DIR"/en.xml", &g_lang);
+    if(SMRZR_OK != status) {
+        fprintf(stderr, "Failed to parse EN language specific rules file\nExiting...\n");
+        return(1);
+    }
+
     if(SMRZR_TRUE == g_is_daemon) {
         if(-1 == (pid = fork())) {
             perror("Failed to create a child process: ");
@@ -238,13 +515,24 @@ main(int argc, char** argv)
 void
 usage(const char* prog)
 {
-    fprintf(stderr, "Usage:\n%s -p <port> -l <logfile> -v <verbosity> -n <numclients> -i <pidfile> -w <numworkers> [-f]\n", prog);
+    fprintf(stderr, "Usage:\n%s -p <port> -l <logfile> -v <verbosity> -n <numclients> -i <pidfile> -w <numworkers> -c <numcomputers> -m <cachebytes> -M <analysisbytes> [-a] [-H] [-f]\n", prog);
     fprintf(stderr, "%s -h (prints this help)\n\n", prog);
     fprintf(stderr, "logfile    : logging file [/var/log/summarizerd.log]\n");
     fprintf(stderr, "pidfile    : pid file [/var/log/summarizerd.pid]\n");
     fprintf(stderr, "port       : port on which to listen [9872]\n");
-    fprintf(stderr, "numclients : number of clients to listen for [32] (<=32)\n");
-    fprintf(stderr, "numworkers : number of workers to use [4] (<=4)\n");
+    fprintf(stderr, "numclients : number of pending clients to queue [%d] (<=%d)\n",
+                    DEFAULT_CLIENTS, MAX_CLIENTS);
+    fprintf(stderr, "numworkers : number of workers reading requests and writing\n"
+                    "             replies [%d] (<=%d)\n", DEFAULT_WORKERS, MAX_WORKERS);
+    fprintf(stderr, "numcomputers : number of threads summarizing [online cpus] (<=%d)\n",
+                    MAX_COMPUTERS);
+    fprintf(stderr, "cachebytes : memory for summaries of files, reused while a file\n"
+                    "             is unchanged [%lu] (0 disables)\n", DEFAULT_CACHE_BYTES);
+    fprintf(stderr, "analysisbytes : memory for parsed files, to summarize them again at\n"
+                    "             any ratio [%lu] (0 disables)\n", DEFAULT_ANALYSIS_BYTES);
+    fprintf(stderr, "        -a : pin each worker and compute thread to its own cpu\n");
+    fprintf(stderr, "        -H : back the words each compute thread works on with\n"
+                    "             huge pages, set aside or else transparent ones\n");
     fprintf(stderr, "        -f : run summarizerd in foreground\n");
     fprintf(stderr, "verbosity  : verbosity of logging, a number in 1-7 [3]\n");
     fprintf(stderr, "                1-fatal, 2-crit, 3-error, 4-warn, 5-notice, 6-info, 7-debug\n");
@@ -361,6 +649,7 @@ setup_signal_handlers(void)
         || setup_one_signal_handler(SIGINT, &sa, sighnd_note)
         || setup_one_signal_handler(SIGHUP, &sa, sighnd_note)
         || setup_one_signal_handler(SIGUSR1, &sa, sighnd_note)
+        || setup_one_signal_handler(SIGUSR2, &sa, sighnd_note)
         || setup_one_signal_handler(SIGCHLD, &sa, sighnd_note)
         || setup_one_signal_handler(SIGPIPE, &sa, SIG_IGN);
 
@@ -411,6 +700,14 @@ main_proc(void)
         handle_io_streams();
     }
 
+    init_socks();
+
+    init_cache();
+
+    init_analyses();
+
+    init_computers();
+
     init_workers();
 
     setup_socket();
@@ -482,11 +779,116 @@ handle_io_streams(void)
     dup2(g_dev_null, 2);
 }
 
+void
+init_socks(void)
+{
+    struct rlimit    rl;
+    int              i, num;
+
+    /* as many connections as we may have fds, within the table's limit */
+    if(0 != getrlimit(RLIMIT_NOFILE, &rl)) {
+        LOG(LL_FATAL, "Can't get fd limit - %s", strerror(errno));
+        quit(EXIT_CANT_RECOVER);
+    }
+
+    if(rl.rlim_cur < MAX_SOCKS && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = (rl.rlim_max < MAX_SOCKS) ? rl.rlim_max : MAX_SOCKS;
+        if(0 != setrlimit(RLIMIT_NOFILE, &rl))
+            LOG(LL_WARN, "Can't raise fd limit - %s", strerror(errno));
+        getrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    num = (rl.rlim_cur < MAX_SOCKS) ? (int)rl.rlim_cur : MAX_SOCKS;
+
+    if(NULL == (g_socks = (sock_context_t*)calloc(num, sizeof(sock_context_t)))) {
+        LOG(LL_FATAL, "Can't allocate %d socket contexts", num);
+        quit(EXIT_CANT_RECOVER);
+    }
+
+    for(i = 0; i < num; ++i)
+        g_socks[i].sock = -1;
+
+    g_max_socks = num;
+
+    /* level-triggered and never read, so it wakes every poller */
+    if(0 > (g_quit_fd = eventfd(0, EFD_NONBLOCK))) {
+        LOG(LL_FATAL, "Can't create quit event - %s", strerror(errno));
+        quit(EXIT_CANT_RECOVER);
+    }
+
+    LOG(LL_DEBUG, "Room for %d connections", g_max_socks);
+}
+
+void
+init_cache(void)
+{
+    if(0 == g_cache.budget)
+        return;
+
+    if(NULL == (g_cache.buckets = (cache_entry_t**)calloc(CACHE_BUCKETS,
+                                                      sizeof(cache_entry_t*)))) {
+        LOG(LL_FATAL, "Can't allocate summary cache buckets");
+        quit(EXIT_CANT_RECOVER);
+    }
+
+    LOG(LL_DEBUG, "Caching up to %lu bytes of summaries", g_cache.budget);
+}
+
+void
+destroy_cache(void)
+{
+    while(NULL != g_cache.head)
+        cache_remove(g_cache.head);
+
+    free(g_cache.buckets);
+    g_cache.buckets = NULL;
+}
+
+void
+init_analyses(void)
+{
+    if(0 == g_analyses.budget)
+        return;
+
+    if(NULL == (g_analyses.buckets = (analysis_t**)calloc(CACHE_BUCKETS,
+                                                      sizeof(analysis_t*)))) {
+        LOG(LL_FATAL, "Can't allocate analysis cache buckets");
+        quit(EXIT_CANT_RECOVER);
+    }
+
+    /* without it, changed files are still caught by their stat */
+    if(0 > (g_watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)))
+        LOG(LL_WARN, "Can't watch analyzed files - %s", strerror(errno));
+
+    LOG(LL_DEBUG, "Caching up to %lu bytes of analyses", g_analyses.budget);
+}
+
+void
+destroy_analyses(void)
+{
+    analysis_t * a;
+
+    /* requests still holding them are gone by now */
+    while(NULL != (a = g_analyses.head)) {
+        analysis_remove(a);
+        free(a);
+    }
+
+    free(g_analyses.buckets);
+    g_analyses.buckets = NULL;
+
+    if(0 <= g_watch_fd)
+        close(g_watch_fd);
+    g_watch_fd = -1;
+}
+
 void
 init_workers(void)
 {
-    int              i;
-    pthread_attr_t   attr;
+    int                  i;
+    pthread_attr_t       attr;
+    struct epoll_event   ev;
+    sigset_t             sigs, old_sigs;
 
     if(0 != pthread_attr_init(&attr)) {
         LOG(LL_FATAL, "Can't init pthread attr object");
@@ -498,49 +900,192 @@ init_workers(void)
         quit(EXIT_CANT_RECOVER);
     }
 
+    if(NULL == (g_worker_contexts = (worker_context_t*)calloc(g_num_workers,
+                                                  sizeof(worker_context_t)))) {
+        LOG(LL_FATAL, "Can't allocate %d worker contexts", g_num_workers);
+        quit(EXIT_CANT_RECOVER);
+    }
+
+    for(i = 0; i < g_num_workers; ++i) {
+        g_worker_contexts[i].id = i;
+        g_worker_contexts[i].epoll_fd = -1;
+        g_worker_contexts[i].wake_fd = -1;
+        g_worker_contexts[i].cpu = -1;
+        g_worker_contexts[i].pending_head = -1;
+        g_worker_contexts[i].pending_tail = -1;
+        g_worker_contexts[i].done_head = NULL;
+        g_worker_contexts[i].done_tail = NULL;
+        pthread_mutex_init(&g_worker_contexts[i].lock, NULL);
+    }
+
+    if(SMRZR_TRUE == g_pin_workers)
+        pin_workers();
+
+    /* load dumps on SIGUSR2 are left to the acceptor */
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGUSR2);
+    pthread_sigmask(SIG_BLOCK, &sigs, &old_sigs);
+
     for(i = 0; i < g_num_workers; ++i) {
 
-        if(0 != pthread_mutex_lock(&g_worker_contexts[i].mutex)) {
-            LOG(LL_FATAL, "Can't lock worker context# %u", i);
+        if(0 > (g_worker_contexts[i].epoll_fd = epoll_create1(0))) {
+            LOG(LL_FATAL, "Can't create epoll for worker# %u - %s", i,
+                          strerror(errno));
             quit(EXIT_CANT_RECOVER);
         }
 
-        if(NULL == g_worker_contexts[i].sock_contexts) {
+        if(0 > (g_worker_contexts[i].wake_fd = eventfd(0, EFD_NONBLOCK))) {
+            LOG(LL_FATAL, "Can't create wake event for worker# %u - %s", i,
+                          strerror(errno));
+            quit(EXIT_CANT_RECOVER);
+        }
 
-            if(NULL == (g_worker_contexts[i].sock_contexts = array_new(SMRZR_TRUE,
-                sizeof(sock_context_t), EXPECTED_CLI_PER_WORKER, NULL)))
-            {
-                LOG(LL_FATAL, "Can't create socket contexts for worker# %u", i);
-		pthread_mutex_unlock(&g_worker_contexts[i].mutex);
-                quit(EXIT_CANT_RECOVER);
-            }
+        ev.events = EPOLLIN;
+        ev.data.fd = g_worker_contexts[i].wake_fd;
 
-            if(0 != pthread_create(&g_workers[i], &attr, &worker,
-                                   &g_worker_contexts[i]))
-            {
-                LOG(LL_FATAL, "Can't create worker# %u", i);
-                pthread_mutex_unlock(&g_worker_contexts[i].mutex);
-                quit(EXIT_CANT_RECOVER);
-            }
+        if(0 != epoll_ctl(g_worker_contexts[i].epoll_fd, EPOLL_CTL_ADD,
+                          g_worker_contexts[i].wake_fd, &ev)) {
+            LOG(LL_FATAL, "Can't add wake event for worker# %u - %s", i,
+                          strerror(errno));
+            quit(EXIT_CANT_RECOVER);
+        }
 
-            if(0 != pthread_detach(g_workers[i])) {
-                LOG(LL_FATAL, "Can't detach worker# %u", i);
-                pthread_mutex_unlock(&g_worker_contexts[i].mutex);
-                quit(EXIT_CANT_RECOVER);
-            }
+        ev.events = EPOLLIN;
+        ev.data.fd = g_quit_fd;
+
+        if(0 != epoll_ctl(g_worker_contexts[i].epoll_fd, EPOLL_CTL_ADD,
+                          g_quit_fd, &ev)) {
+            LOG(LL_FATAL, "Can't add quit event for worker# %u - %s", i,
+                          strerror(errno));
+            quit(EXIT_CANT_RECOVER);
+        }
+
+        if(0 <= g_worker_contexts[i].cpu) {
+            cpu_set_t cpus;
+            CPU_ZERO(&cpus);
+            CPU_SET(g_worker_contexts[i].cpu, &cpus);
+            if(0 != pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus))
+                LOG(LL_WARN, "Can't pin worker# %u to cpu %d", i,
+                             g_worker_contexts[i].cpu);
         }
 
-        if(0 != pthread_mutex_unlock(&g_worker_contexts[i].mutex)) {
-            LOG(LL_FATAL, "Can't lock worker context# %u", i);
+        if(0 != pthread_create(&g_worker_contexts[i].thread, &attr, &worker,
+                               &g_worker_contexts[i]))
+        {
+            LOG(LL_FATAL, "Can't create worker# %u", i);
             quit(EXIT_CANT_RECOVER);
         }
+
+        ++g_num_started;
     }
 
+    pthread_sigmask(SIG_SETMASK, &old_sigs, NULL);
+
     pthread_attr_destroy(&attr);
 
     LOG(LL_DEBUG, "Completed setting up workers");
 }
 
+void
+init_computers(void)
+{
+    int                  i;
+    pthread_attr_t       attr;
+    sigset_t             sigs, old_sigs;
+    cpu_set_t            cpus;
+
+    if(0 != pthread_attr_init(&attr)) {
+        LOG(LL_FATAL, "Can't init pthread attr object");
+        quit(EXIT_CANT_RECOVER);
+    }
+
+    if(0 != pthread_attr_setstacksize(&attr, MAX_STACK_SIZE)) {
+        LOG(LL_FATAL, "Can't init pthread stack size tp '%u'", MAX_STACK_SIZE);
+        quit(EXIT_CANT_RECOVER);
+    }
+
+    if(NULL == (g_computer_contexts = (computer_context_t*)calloc(
+                              g_num_computers, sizeof(computer_context_t)))) {
+        LOG(LL_FATAL, "Can't allocate %d compute contexts", g_num_computers);
+        quit(EXIT_CANT_RECOVER);
+    }
+
+    for(i = 0; i < g_num_computers; ++i) {
+        g_computer_contexts[i].id = i;
+        g_computer_contexts[i].cpu = -1;
+    }
+
+    if(SMRZR_TRUE == g_pin_workers)
+        pin_workers();
+
+    /* they never wait on anything the noted signals would interrupt */
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGTERM);
+    sigaddset(&sigs, SIGINT);
+    sigaddset(&sigs, SIGHUP);
+    sigaddset(&sigs, SIGUSR1);
+    sigaddset(&sigs, SIGUSR2);
+    sigaddset(&sigs, SIGCHLD);
+    pthread_sigmask(SIG_BLOCK, &sigs, &old_sigs);
+
+    for(i = 0; i < g_num_computers; ++i) {
+
+        if(0 <= g_computer_contexts[i].cpu) {
+            CPU_ZERO(&cpus);
+            CPU_SET(g_computer_contexts[i].cpu, &cpus);
+            if(0 != pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus))
+                LOG(LL_WARN, "Can't pin compute thread# %u to cpu %d", i,
+                             g_computer_contexts[i].cpu);
+        }
+
+        if(0 != pthread_create(&g_computer_contexts[i].thread, &attr,
+                               &computer, &g_computer_contexts[i]))
+        {
+            LOG(LL_FATAL, "Can't create compute thread# %u", i);
+            quit(EXIT_CANT_RECOVER);
+        }
+
+        ++g_num_computers_started;
+    }
+
+    pthread_sigmask(SIG_SETMASK, &old_sigs, NULL);
+
+    pthread_attr_destroy(&attr);
+
+    LOG(LL_DEBUG, "Completed setting up compute threads");
+}
+
+void
+pin_workers(void)
+{
+    cpu_set_t   allowed;
+    int         i, cpu = -1;
+
+    /* spread workers, then compute threads, over the cpus we may run on,
+       wrapping around; the same for whichever are set up so far */
+    if(0 != sched_getaffinity(0, sizeof(allowed), &allowed) ||
+       0 == CPU_COUNT(&allowed)) {
+        LOG(LL_WARN, "Can't get cpus to pin workers to - %s", strerror(errno));
+        return;
+    }
+
+    for(i = 0; i < g_num_workers + g_num_computers; ++i) {
+        do {
+            cpu = (cpu + 1) % CPU_SETSIZE;
+        } while(!CPU_ISSET(cpu, &allowed));
+
+        if(i < g_num_workers) {
+            if(NULL == g_worker_contexts) continue;
+            g_worker_contexts[i].cpu = cpu;
+            LOG(LL_DEBUG, "Worker# %u to be pinned to cpu %d", i, cpu);
+        } else if(NULL != g_computer_contexts) {
+            g_computer_contexts[i - g_num_workers].cpu = cpu;
+            LOG(LL_DEBUG, "Compute thread# %u to be pinned to cpu %d",
+                          i - g_num_workers, cpu);
+        }
+    }
+}
+
 void
 setup_socket(void)
 {
@@ -594,41 +1139,75 @@ setup_socket(void)
 void
 quit(int err)
 {
-    int i;
-    array_t* a;
-    sock_context_t* s;
+    int       i, first = 0;
+    uint64_t  one = 1;
 
     LOG(LL_DEBUG, "Exiting with err - %d", err);
 
-    if(0 != g_err) err = g_err; /* somebody initiated quit */
-    else g_err = err; /* don't initiate quit anymore */
+    /* a worker may be initiating quit meanwhile */
+    if(!__atomic_compare_exchange_n(&g_err, &first, err, 0,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        err = first; /* somebody initiated quit */
 
     g_exiting = 1;
 
     LOG(LL_DEBUG, "Signaling all the workers");
-    for(i = 0; i < g_num_workers; ++i) {
-        pthread_cond_signal(&g_worker_contexts[i].cond);
-        pthread_kill(g_workers[i], SIGUSR1);
-    }
+    if(0 <= g_quit_fd && sizeof(one) != write(g_quit_fd, &one, sizeof(one)))
+        LOG(LL_ERROR, "Can't signal quit event - %s", strerror(errno));
 
     LOG(LL_DEBUG, "Waiting for all the workers");
-    for(i = 0; i < g_num_workers; ++i) {
-        pthread_join(g_workers[i], NULL);
-        pthread_cond_destroy(&g_worker_contexts[i].cond);
-        pthread_mutex_destroy(&g_worker_contexts[i].mutex);
+    for(i = 0; i < g_num_started; ++i) {
+        pthread_join(g_worker_contexts[i].thread, NULL);
+    }
+
+    LOG(LL_DEBUG, "Waiting for all the compute threads");
+    pthread_mutex_lock(&g_jobs.lock);
+    g_jobs.quitting = SMRZR_TRUE;
+    pthread_cond_broadcast(&g_jobs.ready);
+    pthread_mutex_unlock(&g_jobs.lock);
+
+    for(i = 0; i < g_num_computers_started; ++i) {
+        pthread_join(g_computer_contexts[i].thread, NULL);
+    }
+
+    if(0 < g_num_started)
+        log_worker_loads();
+
+    free(g_computer_contexts);
+
+    free_requests(g_jobs.head);
+
+    destroy_cache();
+
+    destroy_analyses();
+
+    for(i = 0; NULL != g_worker_contexts && i < g_num_workers; ++i) {
+        if(0 <= g_worker_contexts[i].epoll_fd)
+            close(g_worker_contexts[i].epoll_fd);
+        if(0 <= g_worker_contexts[i].wake_fd)
+            close(g_worker_contexts[i].wake_fd);
+        free_requests(g_worker_contexts[i].done_head);
+        pthread_mutex_destroy(&g_worker_contexts[i].lock);
     }
+    free(g_worker_contexts);
 
     LOG(LL_DEBUG, "Closing all the sockets used by workers");
-    for(i = 0; i < g_num_workers; ++i) {
-        a = g_worker_contexts[i].sock_contexts;
-        for(s = (sock_context_t*)ARR_FIRST(a); !ARR_END(a); s = (sock_context_t*)ARR_NEXT(a)) {
-            close(s->sock);
+    for(i = 0; i < g_max_socks; ++i) {
+        if(0 <= g_socks[i].sock) {
+            close(g_socks[i].sock);
+            free_requests(g_socks[i].in);
+            free_requests(g_socks[i].out_head);
+            free_requests(g_socks[i].spare);
         }
-        array_free(a);
     }
+    free(g_socks);
 
     LOG(LL_DEBUG, "Closing main listening socket");
     close(g_main_sock);
+    close(g_quit_fd);
+
+    LOG(LL_DEBUG, "Releasing language rules");
+    lang_destroy(&g_lang);
 
     LOG(LL_DEBUG, "Cleaning up pid registration");
     file_lock_un(g_pid_fd);
@@ -662,425 +1241,1950 @@ file_lock_un(int fd)
 int
 handle_accept_nb(void)
 {
-    struct sockaddr_in  a;
-    fd_set              fds;
-    int                 res, sock;
-    socklen_t           a_len;
+    struct epoll_event  ev, events[3];
+    int                 epoll_fd, num, i, res = 0, sock;
 
     LOG(LL_INFO, "Listening on all interfaces...");
 
-    while(1) {
+    if(0 > (epoll_fd = epoll_create1(0))) {
+        LOG(LL_FATAL, "epoll: failed to create - %s", strerror(errno));
+        return(EXIT_CANT_RECOVER);
+    }
 
-        FD_ZERO(&fds);
-        FD_SET(g_main_sock, &fds);
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.fd = g_main_sock;
 
-        if(0 == (res = select(g_main_sock+1, &fds, NULL, NULL, NULL))) {
-            LOG(LL_FATAL, "select: woke up abruptly");
-            return(EXIT_CANT_RECOVER);
-        }
+    if(0 != epoll_ctl(epoll_fd, EPOLL_CTL_ADD, g_main_sock, &ev)) {
+        LOG(LL_FATAL, "epoll: failed to add listener - %s", strerror(errno));
+        close(epoll_fd);
+        return(EXIT_CANT_RECOVER);
+    }
 
-        if(res < 0) {
-            return handle_select_error();
-        }
+    ev.events = EPOLLIN;
+    ev.data.fd = g_quit_fd;
 
-        a_len = sizeof(a);
+    if(0 != epoll_ctl(epoll_fd, EPOLL_CTL_ADD, g_quit_fd, &ev)) {
+        LOG(LL_FATAL, "epoll: failed to add quit event - %s", strerror(errno));
+        close(epoll_fd);
+        return(EXIT_CANT_RECOVER);
+    }
 
-        if(0 > (sock = accept(g_main_sock, (struct sockaddr*)&a, &a_len))) {
-            switch(errno) {
-                BLOCKCASES: /* select misreported activity */
-                    LOG(LL_NOTICE, "accept: select spurious, continuing");
-                    continue;
-                case ECONNABORTED: /* it's ok, continue accepting */
-                    LOG(LL_NOTICE, "accept: connection aborted, continuing");
-                    continue;
-                case EINTR: /* interrpted by signal */
-                    switch(g_sig) {
-                        TERMSIGCASES:
-                            LOG(LL_NOTICE, "accept: term signal %d", g_sig);
-                            return(EXIT_OK);
-                        CRASHSIGCASES:
-                            LOG(LL_CRIT, "accept: crash signal %d", g_sig);
-                            return(EXIT_CRASH);
-                        default:
-                            LOG(LL_CRIT, "accept: signal %d", g_sig);
-                            return(EXIT_CANT_RECOVER);
-                    }
-                default: /* anything else is bad */
-                    LOG(LL_FATAL, "accept: %s", strerror(errno));
-                    return(EXIT_CANT_RECOVER);
+    ev.events = EPOLLIN;
+    ev.data.fd = g_watch_fd;
+
+    /* changes to analyzed files come in with the connections */
+    if(0 <= g_watch_fd && 0 != epoll_ctl(epoll_fd, EPOLL_CTL_ADD, g_watch_fd, &ev)) {
+        LOG(LL_FATAL, "epoll: failed to add watch - %s", strerror(errno));
+        close(epoll_fd);
+        return(EXIT_CANT_RECOVER);
+    }
+
+    while(0 == res) {
+
+        if(0 > (num = epoll_wait(epoll_fd, events, 3, -1))) {
+            if(EINTR == errno && SIGUSR2 == g_sig) {
+                g_sig = -1;
+                log_worker_loads();
+                continue;
             }
+            res = handle_wait_error();
+            break;
         }
 
-        LOG(LL_DEBUG, "Socket accepted: %d", sock);
+        for(i = 0; i < num && 0 == res; ++i) {
 
-        if(0 != fcntl(sock, F_SETFL, O_NONBLOCK)) {
-            LOG(LL_FATAL, "accepted socket: failed to NB %s", strerror(errno));
-            return(EXIT_CANT_RECOVER);
-        }
+            if(g_quit_fd == events[i].data.fd) { /* a worker gave up */
+                LOG(LL_NOTICE, "accept: quit requested");
+                res = __atomic_load_n(&g_err, __ATOMIC_ACQUIRE);
+                if(0 == res) res = EXIT_OK;
+                break;
+            }
 
-        if(0 != (res = assign_to_worker(sock))) {
-            return(res);
+            if(g_watch_fd == events[i].data.fd) {
+                handle_watch_events();
+                continue;
+            }
+
+            /* edge-triggered, so take every pending connection */
+            while(0 == res) {
+
+                if(0 > (sock = accept(g_main_sock, NULL, NULL))) {
+                    if(EAGAIN == errno || EWOULDBLOCK == errno) break;
+
+                    switch(errno) {
+                        case ECONNABORTED: /* it's ok, continue accepting */
+                            LOG(LL_NOTICE, "accept: connection aborted, continuing");
+                            continue;
+                        case EMFILE: case ENFILE: case ENOBUFS: case ENOMEM:
+                            /* the rest are taken on the next connection */
+                            LOG(LL_WARN, "accept: %s, waiting", strerror(errno));
+                            break;
+                        case EINTR: /* interrpted by signal */
+                            switch(g_sig) {
+                                TERMSIGCASES:
+                                    LOG(LL_NOTICE, "accept: term signal %d", g_sig);
+                                    res = EXIT_OK; break;
+                                CRASHSIGCASES:
+                                    LOG(LL_CRIT, "accept: crash signal %d", g_sig);
+                                    res = EXIT_CRASH; break;
+                                default:
+                                    LOG(LL_CRIT, "accept: signal %d", g_sig);
+                                    res = EXIT_CANT_RECOVER; break;
+                            }
+                            break;
+                        default: /* anything else is bad */
+                            LOG(LL_FATAL, "accept: %s", strerror(errno));
+                            res = EXIT_CANT_RECOVER;
+                            break;
+                    }
+                    break;
+                }
+
+                LOG(LL_DEBUG, "Socket accepted: %d", sock);
+
+                if(0 != fcntl(sock, F_SETFL, O_NONBLOCK)) {
+                    LOG(LL_FATAL, "accepted socket: failed to NB %s", strerror(errno));
+                    close(sock);
+                    res = EXIT_CANT_RECOVER;
+                    break;
+                }
+
+                res = assign_to_worker(sock);
+            }
         }
     }
 
-    return(EXIT_OK); /* should not reach here */
+    close(epoll_fd);
+
+    return(res);
 }
 
 int
 assign_to_worker(int sock)
 {
-#define MASTER_LOCK_WORKER(ctxt) \
-do { \
-    if(0 != pthread_mutex_lock(&ctxt.mutex)) { \
-        LOG(LL_FATAL, "Can't lock worker context mutex"); \
-        return(EXIT_CANT_RECOVER); \
-    } \
-} while(0)
-
-#define MASTER_UNLOCK_WORKER(ctxt) \
-do { \
-    if(0 != pthread_mutex_unlock(&ctxt.mutex)) { \
-        LOG(LL_FATAL, "Can't unlock worker context mutex"); \
-        return(EXIT_CANT_RECOVER); \
-    } \
-} while(0)
-
-#define MASTER_SIGNAL_WORKER(ctxt) \
-do { \
-    if(0 != pthread_cond_signal(&ctxt.cond)) { \
-        LOG(LL_FATAL, "Can't signal worker"); \
-        return(EXIT_CANT_RECOVER); \
-    } \
-} while(0)
-
-    static int       s_worker_no = 0;
-    sock_context_t * sock_ctxt = NULL;
-    bool_t           is_new = SMRZR_FALSE;
-
-    /* enqueue the new socket to a worker in round-robin */
-
-    MASTER_LOCK_WORKER(g_worker_contexts[s_worker_no]);
-
-    if(NULL == (sock_ctxt = array_search_or_alloc(
-                                &g_worker_contexts[s_worker_no].sock_contexts,
-                                (elem_t)(intptr_t)sock, comp_sock_context, &is_new)))
-    {
-        LOG(LL_ERROR, "Failed to allocate context for worker %d for socket %d",
-                      s_worker_no, sock);
-        MASTER_UNLOCK_WORKER(g_worker_contexts[s_worker_no]);
-        return(EXIT_CANT_RECOVER);
+    sock_context_t    * sock_ctxt;
+    worker_context_t  * w;
+
+    if(sock >= g_max_socks) {
+        LOG(LL_ERROR, "Dropping client sock %d beyond %d connections",
+                      sock, g_max_socks);
+        close(sock);
+        return(0);
     }
 
-    assert(SMRZR_TRUE == is_new);
+    /* the worker owns the context from when it takes the socket */
+    sock_ctxt = &g_socks[sock];
+
+    /* its last owner let go of it before closing the fd */
+    if(0 <= SLOT_GET(sock_ctxt->sock)) {
+        LOG(LL_ERROR, "Dropping client sock %d, its slot is still in use",
+                      sock);
+        close(sock);
+        return(0);
+    }
 
-    sock_ctxt->sock = sock;
-    sock_ctxt->status = SOCK_READ;
-    sock_ctxt->rep_type = REP_SUMMARY;
+    SLOT_SET(sock_ctxt->worker, -1);
+    sock_ctxt->next_pending = -1;
+    sock_ctxt->in = NULL;
     sock_ctxt->req_offset = 0;
-    memset(&sock_ctxt->reqhdr, 0, sizeof(request_header_t));
-    memset(&sock_ctxt->filename, 0, MAX_FILENAME_LEN);
+    sock_ctxt->out_head = sock_ctxt->out_tail = NULL;
+    sock_ctxt->spare = NULL;
+    sock_ctxt->num_inflight = sock_ctxt->num_computing = 0;
+    sock_ctxt->serial = SMRZR_FALSE;
+    sock_ctxt->closing = SMRZR_FALSE;
+    SLOT_SET(sock_ctxt->sock, sock);
+
+    /* hand the new socket to the least loaded worker; it is polled once the
+       worker takes it, unless an idle one steals it first */
+    w = &g_worker_contexts[pick_worker()];
 
-    if(g_worker_contexts[s_worker_no].max_fds <= sock)
-        g_worker_contexts[s_worker_no].max_fds = sock + 1;
+    pthread_mutex_lock(&w->lock);
 
-    MASTER_UNLOCK_WORKER(g_worker_contexts[s_worker_no]);
+    if(0 > w->pending_tail)
+        w->pending_head = sock;
+    else
+        g_socks[w->pending_tail].next_pending = sock;
 
-    LOG(LL_DEBUG, "Added client sock %d to worker %u", sock, s_worker_no);
+    w->pending_tail = sock;
+    COUNTER_ADD(w->num_pending, 1);
 
-    MASTER_SIGNAL_WORKER(g_worker_contexts[s_worker_no]);
+    pthread_mutex_unlock(&w->lock);
 
-    s_worker_no = (s_worker_no + 1) % g_num_workers; /* rotate worker */
+    wake_worker(w);
+
+    LOG(LL_DEBUG, "Handed client sock %d to worker %d (%lu busy bytes)",
+                  sock, w->id, COUNTER_GET(w->busy_bytes));
 
     return(0);
 }
 
-void*
-worker(void* arg)
+int
+pick_worker(void)
 {
-#define THREAD_EXIT(status) \
-    lang_destroy(&lang); \
-    article_destroy(&article); \
-    initiate_quit(status); \
-    pthread_exit(NULL)
-
-    worker_context_t* ctxt = (worker_context_t*)arg;
-    status_t          status;
-    lang_t            lang;
-    article_t         article;
-    int               res;
-
-    status =
-        lang_init(&lang)
-     || parse_lang_xml(DICTIONARY_DIR"/en.xml", &lang)
-     || article_init(&article);
-
-    if(SMRZR_OK != status) {
-        LOG(LL_ERROR, "Failed to parse EN language specific rules file\n");
-        THREAD_EXIT(EXIT_CANT_RECOVER);
-    }
-
-    while(1) {
+    static int          s_start = 0;
+    worker_context_t  * w;
+    size_t              bytes, conns, best_bytes = 0, best_conns = 0;
+    int                 i, j, best = -1;
 
-        /* wait until we have a sock available */
+    /* fewest document bytes in hand, then fewest connections; the scan
+       starts one further each time so that equals are taken in turn */
+    for(i = 0; i < g_num_workers; ++i) {
 
-        if(0 != pthread_mutex_lock(&ctxt->mutex)) {
-            LOG(LL_FATAL, "Can't lock thread context mutex");
-            THREAD_EXIT(EXIT_CANT_RECOVER);
-        }
+        j = (s_start + i) % g_num_workers;
+        w = &g_worker_contexts[j];
 
-        while(0 == ctxt->max_fds && 0 == g_exiting) {
-            LOG(LL_DEBUG, "Waiting as there is no client sock available");
-            if(0 != pthread_cond_wait(&ctxt->cond, &ctxt->mutex)) {
-                LOG(LL_FATAL, "Can't wait in worker ");
-                THREAD_EXIT(EXIT_CANT_RECOVER);
-            }
-        }
+        bytes = COUNTER_GET(w->busy_bytes);
+        conns = COUNTER_GET(w->num_socks) + COUNTER_GET(w->num_pending);
 
-        if(0 != pthread_mutex_unlock(&ctxt->mutex)) {
-            LOG(LL_FATAL, "Can't unlock thread context mutex");
-            THREAD_EXIT(EXIT_CANT_RECOVER);
+        if(0 > best || bytes < best_bytes ||
+           (bytes == best_bytes && conns < best_conns))
+        {
+            best = j;
+            best_bytes = bytes;
+            best_conns = conns;
         }
+    }
 
-        if(1 == g_exiting) {
-            LOG(LL_NOTICE, "Graceful exit requested.. worker exiting");
-            THREAD_EXIT(EXIT_OK);
-        }
+    s_start = (s_start + 1) % g_num_workers;
 
-        /* handle a client on this sock */
-        if(0 != (res = worker_loop(ctxt, &lang, &article))) {
-            LOG(LL_CRIT, "Encountered errors in worker loop");
-            THREAD_EXIT(res);
-        }
-    }
+    return(best);
 }
 
 void
-initiate_quit(int err)
+wake_worker(worker_context_t* w)
 {
-    if(0 == g_err) { /* don't do more than once */
-        LOG(LL_INFO, "Initiating quit with err %d", err);
-        g_err = err;
-        kill(g_pid, SIGUSR1); /*send signal to main thread */
-    }
+    uint64_t one = 1;
+
+    if(sizeof(one) != write(w->wake_fd, &one, sizeof(one)))
+        LOG(LL_ERROR, "Can't wake worker %d - %s", w->id, strerror(errno));
 }
 
 int
-worker_loop(worker_context_t* ctxt, lang_t* lang, article_t* article)
+adopt_pending(worker_context_t* ctxt, worker_context_t* from)
 {
-    int              res, i;
-    uint32_t         r;
-    float            ratio;
-    status_t         status;
-    fd_set           read_fds, write_fds, except_fds;
-    array_t        * a = ctxt->sock_contexts;
-    struct timeval   tv;
-    sock_context_t * s;
+    struct epoll_event  ev;
+    sock_context_t    * s;
+    int                 sock, next, num = 0;
 
-    while(1) {
+    pthread_mutex_lock(&from->lock);
 
-        FD_ZERO(&read_fds);
-        FD_ZERO(&write_fds);
-        FD_ZERO(&except_fds);
+    sock = from->pending_head;
+    from->pending_head = from->pending_tail = -1;
+    COUNTER_SET(from->num_pending, 0);
 
-        if(0 != pthread_mutex_lock(&ctxt->mutex)) {
-            LOG(LL_FATAL, "Can't lock thread context mutex");
-            return(EXIT_CANT_RECOVER);
-        }
+    pthread_mutex_unlock(&from->lock);
 
-        for(s = (sock_context_t*)ARR_FIRST(a); !ARR_END(a); s = (sock_context_t*)ARR_NEXT(a)) {
-            FD_SET(s->sock, &read_fds);
-            FD_SET(s->sock, &except_fds);
-            if(SOCK_WRITE == s->status)
-                FD_SET(s->sock, &write_fds);
-        }
+    for(; 0 <= sock; sock = next) {
 
-        if(0 != pthread_mutex_unlock(&ctxt->mutex)) {
-            LOG(LL_FATAL, "Can't unlock thread context mutex");
-            return(EXIT_CANT_RECOVER);
-        }
+        s = &g_socks[sock];
+        SLOT_SET(s->worker, ctxt->id);
+        next = s->next_pending; /* the slot is reused once closed */
 
-        tv.tv_sec = 0;
-        tv.tv_usec = CLIENT_WAIT_TIME;
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+        ev.data.fd = sock;
 
-        if(0 == (res = select(ctxt->max_fds, &read_fds, &write_fds, &except_fds, &tv))) {
-            LOG(LL_DEBUG, "select: woke up after timeout");
+        /* reports the socket at once if it is readable already */
+        if(0 != epoll_ctl(ctxt->epoll_fd, EPOLL_CTL_ADD, sock, &ev)) {
+            LOG(LL_ERROR, "Failed to add socket %d to worker %d - %s",
+                          sock, ctxt->id, strerror(errno));
+            SLOT_SET(s->worker, -1);
+            SLOT_SET(s->sock, -1);
+            close(sock);
             continue;
         }
 
-        if(res < 0) {
-            return handle_select_error();
-        }
-
-        for(i = 0; i < ctxt->max_fds; ++i) {
+        COUNTER_ADD(ctxt->num_socks, 1);
+        ++num;
 
-            res = 0; s = NULL;
+        LOG(LL_DEBUG, "Added client sock %d to worker %d", sock, ctxt->id);
+    }
 
-            if(FD_ISSET(i, &read_fds)) { /* read the request */
+    if(ctxt != from)
+        COUNTER_ADD(ctxt->num_stolen, num);
 
-                LOG(LL_DEBUG, "Socket %d has read activity", i);
+    return(num);
+}
 
-                s = array_search(ctxt->sock_contexts, (elem_t)(intptr_t)i, comp_sock_context);
+void
+steal_pending(worker_context_t* ctxt)
+{
+    worker_context_t  * w;
+    int                 i, num;
 
-                assert(NULL != s);
+    /* sockets left with a worker busy with requests would wait for it */
+    for(i = 0; i < g_num_workers; ++i) {
 
-                if(0 > (res = read_summary_request(s))) {
+        w = &g_worker_contexts[i];
 
-                    if(0 >= (res = handle_read_error(res, ctxt, s)))
-                        return(res);
+        if(w == ctxt || 0 == COUNTER_GET(w->num_pending) ||
+           0 == COUNTER_GET(w->num_busy))
+            continue;
 
-                    if(s->status == SOCK_WRITE) res = 0;
+        if(0 < (num = adopt_pending(ctxt, w)))
+            LOG(LL_INFO, "Worker %d took %d sockets from busy worker %d",
+                         ctxt->id, num, i);
+    }
+}
 
-                } else if (res > 0) {
-                    LOG(LL_DEBUG, "Set reply type to summary for %d", i);
-                    s->rep_type = REP_SUMMARY;
-                    s->status = SOCK_WRITE;
-                    res = 0;
-                }
-            }
+request_t*
+new_request(sock_context_t* s)
+{
+    request_t* req;
+
+    /* the spare's buffers are likely big enough for the next one */
+    if(NULL != (req = s->spare))
+        s->spare = NULL;
+    else if(NULL == (req = (request_t*)calloc(1, sizeof(request_t))))
+        return(NULL);
+
+    req->next = NULL;
+    req->sock = s->sock;
+    memset(&req->reqhdr, 0, sizeof(request_header_t));
+    req->id = 0;
+    req->index = 0;
+    req->batch = NULL;
+    req->refs = 1;
+    req->doc = NULL;
+    req->rep_type = REP_SUMMARY;
+    req->load = 0;
+    req->loaded = SMRZR_FALSE;
+    req->reply_len = 0;
+    req->cacheable = SMRZR_FALSE;
+    req->analysis = NULL;
+    req->rep_len = req->rep_offset = 0;
+
+    return(req);
+}
 
-            if(0 == res && FD_ISSET(i, &write_fds)) {
+void
+release_request(sock_context_t* s, request_t* req)
+{
+    request_t* batch;
 
-                LOG(LL_DEBUG, "Socket %d ready to write", i);
+    if(0 < --req->refs)
+        return; /* a batch with items still out */
 
-                /* read gave an EAGAIN or it was not in read-set */
-                if(NULL == s)
-                    s = array_search(ctxt->sock_contexts, (elem_t)(intptr_t)i, comp_sock_context);
+    req->next = NULL;
 
-                assert(NULL != s);
-                assert(SOCK_WRITE == s->status);
+    if(NULL != (batch = req->batch)) {
+        /* items only point into the batch, which goes with the last */
+        free(req->reply);
+        free(req);
+        release_request(s, batch);
+    } else if(NULL != s && NULL == s->spare) {
+        s->spare = req;
+    } else {
+        free(req->payload);
+        free(req->reply);
+        free(req);
+    }
+}
 
-                if(REP_SUMMARY == s->rep_type) {
+void
+free_requests(request_t* req)
+{
+    request_t* next;
 
-                    r = s->reqhdr.ratio;
-                    ratio = *((float*)(void*)&r);
-                    ratio = ratio / 100;
+    for(; NULL != req; req = next) {
+        next = req->next;
+        release_request(NULL, req);
+    }
+}
+
+void
+begin_request(sock_context_t* s, request_t* req)
+{
+    worker_context_t* w = &g_worker_contexts[s->worker];
+
+    /* the file of a version 1 request is only known by name */
+    req->load = (SUMMARIZERD_VERSION_FILE == req->reqhdr.ver) ?
+                0 : req->reqhdr.payload_len;
+    req->loaded = SMRZR_TRUE;
+
+    COUNTER_ADD(w->num_busy, 1);
+    COUNTER_ADD(w->busy_bytes, req->load);
+}
+
+void
+end_request(sock_context_t* s, request_t* req, bool_t served)
+{
+    worker_context_t* w = &g_worker_contexts[s->worker];
+
+    if(SMRZR_TRUE != req->loaded)
+        return;
+
+    COUNTER_SUB(w->num_busy, 1);
+    COUNTER_SUB(w->busy_bytes, req->load);
+
+    if(SMRZR_TRUE == served)
+        COUNTER_ADD(w->num_served, 1);
+
+    req->load = 0;
+    req->loaded = SMRZR_FALSE;
+}
+
+void
+log_worker_loads(void)
+{
+    worker_context_t  * w;
+    int                 i;
+
+    for(i = 0; i < g_num_workers; ++i) {
+
+        w = &g_worker_contexts[i];
+
+        LOG(LL_NOTICE, "Worker %d: %lu connections, %lu pending, %lu busy"
+                       " (%lu bytes), %lu served, %lu stolen", i,
+                       COUNTER_GET(w->num_socks), COUNTER_GET(w->num_pending),
+                       COUNTER_GET(w->num_busy), COUNTER_GET(w->busy_bytes),
+                       COUNTER_GET(w->num_served), COUNTER_GET(w->num_stolen));
+    }
+
+    for(i = 0; i < g_num_computers_started; ++i) {
+        LOG(LL_NOTICE, "Compute thread %d: %lu requests summarized", i,
+                       COUNTER_GET(g_computer_contexts[i].num_jobs));
+    }
+
+    pthread_mutex_lock(&g_jobs.lock);
+
+    LOG(LL_NOTICE, "Jobs: %lu queued (%lu at most), %lu taken, waited %lu usecs"
+                   " on average (%lu at most)", g_jobs.depth, g_jobs.max_depth,
+                   g_jobs.num_taken, (unsigned long)(g_jobs.num_taken ?
+                   g_jobs.wait_us / g_jobs.num_taken : 0),
+                   (unsigned long)g_jobs.max_wait_us);
+
+    pthread_mutex_unlock(&g_jobs.lock);
+
+    pthread_mutex_lock(&g_cache.lock);
+
+    LOG(LL_NOTICE, "Cache: %lu summaries in %lu of %lu bytes, %lu hits, %lu"
+                   " misses, %lu stale, %lu evicted", g_cache.num_entries,
+                   g_cache.bytes, g_cache.budget, g_cache.hits, g_cache.misses,
+                   g_cache.stale, g_cache.evicted);
+
+    pthread_mutex_unlock(&g_cache.lock);
+
+    pthread_mutex_lock(&g_analyses.lock);
+
+    LOG(LL_NOTICE, "Analyses: %lu files in %lu of %lu bytes, %lu hits, %lu"
+                   " misses, %lu stale, %lu evicted, %lu dropped on change",
+                   g_analyses.num_entries, g_analyses.bytes, g_analyses.budget,
+                   g_analyses.hits, g_analyses.misses, g_analyses.stale,
+                   g_analyses.evicted, g_analyses.dropped);
+
+    pthread_mutex_unlock(&g_analyses.lock);
+}
+
+void*
+worker(void* arg)
+{
+    worker_context_t* ctxt = (worker_context_t*)arg;
+    int               res;
+
+    /* handle clients on our socks till asked to quit */
+    if(EXIT_OK == (res = worker_loop(ctxt))) {
+        LOG(LL_NOTICE, "Graceful exit requested.. worker exiting");
+    } else {
+        LOG(LL_CRIT, "Encountered errors in worker loop");
+    }
+
+    initiate_quit(res);
+    pthread_exit(NULL);
+}
+
+void
+initiate_quit(int err)
+{
+    uint64_t one = 1;
+    int      first = 0;
+
+    /* don't do more than once */
+    if(__atomic_compare_exchange_n(&g_err, &first, err, 0,
+                                   __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+    {
+        LOG(LL_INFO, "Initiating quit with err %d", err);
+        /* wakes the acceptor, which quits, as well as all workers */
+        if(sizeof(one) != write(g_quit_fd, &one, sizeof(one)))
+            LOG(LL_ERROR, "Can't signal quit event - %s", strerror(errno));
+    }
+}
+
+int
+worker_loop(worker_context_t* ctxt)
+{
+    struct epoll_event   events[MAX_EVENTS];
+    sock_context_t     * s;
+    int                  num, i, res;
+    uint64_t             val;
+
+    while(1) {
+
+        if(0 > (num = epoll_wait(ctxt->epoll_fd, events, MAX_EVENTS, -1))) {
+            return handle_wait_error();
+        }
+
+        for(i = 0; i < num; ++i) {
+
+            if(g_quit_fd == events[i].data.fd) {
+                LOG(LL_DEBUG, "Quit event seen by worker");
+                return(EXIT_OK);
+            }
+
+            if(ctxt->wake_fd == events[i].data.fd) {
+                if(sizeof(val) != read(ctxt->wake_fd, &val, sizeof(val)) &&
+                   EAGAIN != errno)
+                    LOG(LL_ERROR, "Can't clear wake event - %s",
+                                  strerror(errno));
+                adopt_pending(ctxt, ctxt);
+                if(0 > (res = finish_jobs(ctxt)))
+                    return(res);
+                continue;
+            }
+
+            LOG(LL_DEBUG, "Socket %d has activity", events[i].data.fd);
+
+            /* it may have been closed, even reused, since the wait */
+            s = &g_socks[events[i].data.fd];
+            if(0 > SLOT_GET(s->sock) || ctxt->id != SLOT_GET(s->worker))
+                continue;
+
+            if(0 > (res = serve_sock(s)))
+                return(res);
+        }
+
+        steal_pending(ctxt);
+    }
+
+    return(0);
+}
+
+int
+serve_sock(sock_context_t* s)
+{
+    request_t      * req;
+    int              res;
+
+    if(SMRZR_TRUE == s->closing)
+        return(0); /* gone once the compute threads are done with it */
+
+    /* edge-triggered, so go on till the socket would block either way */
+    while(1) {
+
+        if(0 >= (res = send_replies(s)))
+            return(res);
+
+        /* replies to version 1/2 requests go in turn, version 3 ones carry
+           ids and go as they complete, up to a limit */
+        if((SMRZR_TRUE == s->serial && 0 < s->num_inflight) ||
+           MAX_INFLIGHT <= s->num_inflight)
+            return(0); /* read on once replies are sent */
+
+        if(NULL == s->in && NULL == (s->in = new_request(s))) {
+            LOG(LL_ERROR, "Can't allocate a request for %d, closing", s->sock);
+            return(close_peer(s));
+        }
+
+        if(0 > (res = read_summary_request(s))) {
+
+            if(0 >= (res = handle_read_error(res, s)))
+                return(res);
+
+        } else if(0 == res) {
+            return(0); /* EAGAIN => wait for more to read */
+        } else {
+            req = s->in;
+            s->in = NULL;
+
+            s->serial = !IS_PIPELINED(req->reqhdr.ver);
+
+            if(SUMMARIZERD_VERSION_BATCH == req->reqhdr.ver) {
+                split_batch(s, req);
+            } else if(SUMMARIZERD_VERSION_RANKED == req->reqhdr.ver &&
+                      0 > check_ranked(req)) {
+                req->rep_type = REP_ERROR_INVALID_REQ;
+                req->index = BATCH_INDEX_ALL;
+                ++s->num_inflight;
+                queue_reply(s, req);
+            } else if(SUMMARIZERD_VERSION_RANKED == req->reqhdr.ver) {
+                start_request(s, req); /* the document is after the ratios */
+            } else if(SUMMARIZERD_VERSION_FILE == req->reqhdr.ver &&
+                      SMRZR_TRUE == cache_lookup(req)) {
+                ++s->num_inflight;
+                begin_request(s, req);
+                queue_reply(s, req);
+            } else {
+                LOG(LL_DEBUG, "Set reply type to summary for %d", s->sock);
+                req->doc = req->payload;
+                start_request(s, req);
+            }
+        }
+    }
+}
+
+void
+start_request(sock_context_t* s, request_t* req)
+{
+    ++s->num_inflight;
+    ++s->num_computing;
+
+    begin_request(s, req);
+    queue_job(req);
+}
+
+void
+split_batch(sock_context_t* s, request_t* batch)
+{
+    batch_item_header_t  hdr;
+    request_t          * item, * items = NULL, ** tail = &items;
+    int                  count, i;
+    size_t               off = sizeof(uint32_t);
+    float                ratio;
+
+    /* every item is split off before any is summarized, so that a batch
+       that can't be split is replied to as a whole */
+    if(0 > (count = check_batch(batch))) {
+        batch->rep_type = REP_ERROR_INVALID_REQ;
+        count = 0;
+    } else {
+        LOG(LL_DEBUG, "Splitting batch of %d items on %d", count, s->sock);
+    }
+
+    for(i = 0; i < count; ++i) {
+
+        memcpy(&hdr, batch->payload + off, sizeof(hdr));
+        off += sizeof(hdr);
+
+        if(NULL == (item = (request_t*)calloc(1, sizeof(request_t)))) {
+            LOG(LL_ERROR, "Can't allocate item %d of batch on %d", i, s->sock);
+            batch->rep_type = REP_ERROR_INTERNAL_ERROR;
+            break;
+        }
+
+        item->sock = s->sock;
+        item->reqhdr = batch->reqhdr;
+        item->reqhdr.ratio = ntohl(hdr.ratio);
+        item->reqhdr.payload_len = ntohl(hdr.document_len);
+        item->id = batch->id;
+        item->index = i;
+        item->batch = batch;
+        item->refs = 1;
+        item->doc = batch->payload + off;
+        item->rep_type = REP_SUMMARY;
+
+        off += item->reqhdr.payload_len;
+
+        *tail = item;
+        tail = &item->next;
+    }
+
+    if(REP_SUMMARY != batch->rep_type) { /* replied to as a whole */
+        while(NULL != (item = items)) {
+            items = item->next;
+            free(item);
+        }
+        batch->index = BATCH_INDEX_ALL;
+        ++s->num_inflight;
+        queue_reply(s, batch);
+        return;
+    }
+
+    while(NULL != (item = items)) {
+
+        items = item->next;
+        item->next = NULL;
+        ++batch->refs;
+
+        memcpy(&ratio, &item->reqhdr.ratio, sizeof(ratio));
+
+        if(ratio > 100 || ratio < 0) {
+            LOG(LL_INFO, "Invalid ratio - %.2f for item %u", ratio, item->index);
+            item->rep_type = REP_ERROR_INVALID_REQ;
+            ++s->num_inflight;
+            queue_reply(s, item);
+        } else {
+            start_request(s, item);
+        }
+    }
+
+    release_request(s, batch); /* the items hold it now */
+}
+
+int
+check_batch(const request_t* batch)
+{
+    batch_item_header_t  hdr;
+    uint32_t             count, i;
+    size_t               off = sizeof(uint32_t), len = batch->reqhdr.payload_len;
+
+    if(len < off) {
+        LOG(LL_INFO, "Batch too short for its count - %lu", len);
+        return(PROTO_INVALID);
+    }
+
+    memcpy(&count, batch->payload, sizeof(count));
+    count = ntohl(count);
+
+    if(count > MAX_BATCH_ITEMS) {
+        LOG(LL_INFO, "Too many items in batch - %u", count);
+        return(PROTO_INVALID);
+    }
+
+    for(i = 0; i < count; ++i) {
+        if(len - off < sizeof(hdr)) break;
+        memcpy(&hdr, batch->payload + off, sizeof(hdr));
+        off += sizeof(hdr);
+        if(len - off < ntohl(hdr.document_len)) break;
+        off += ntohl(hdr.document_len);
+    }
+
+    if(i < count || off != len) {
+        LOG(LL_INFO, "Batch of %u items doesn't add up to %lu bytes", count, len);
+        return(PROTO_INVALID);
+    }
+
+    return((int)count);
+}
+
+int
+check_ranked(request_t* req)
+{
+    ranked_header_t  hdr;
+    uint32_t         i, r;
+    size_t           off, len = req->reqhdr.payload_len;
+    float            ratio;
+
+    if(len < sizeof(hdr)) {
+        LOG(LL_INFO, "Ranked request too short for its header - %lu", len);
+        return(PROTO_INVALID);
+    }
+
+    memcpy(&hdr, req->payload, sizeof(hdr));
+    hdr.flags = ntohl(hdr.flags);
+    hdr.num_ratios = ntohl(hdr.num_ratios);
+
+    if(hdr.num_ratios > MAX_RANKED_RATIOS ||
+       (0 == hdr.num_ratios &&
+        !(hdr.flags & (RANKED_WITH_RANKING | RANKED_WITH_TERMS)))) {
+        LOG(LL_INFO, "Invalid number of ratios - %u", hdr.num_ratios);
+        return(PROTO_INVALID);
+    }
+
+    off = sizeof(hdr) + hdr.num_ratios * sizeof(uint32_t);
+
+    if(hdr.flags & RANKED_WITH_TERMS)
+        off += sizeof(uint32_t); /* max_terms */
+
+    if(len < off) {
+        LOG(LL_INFO, "Ranked request too short for %u ratios - %lu",
+                     hdr.num_ratios, len);
+        return(PROTO_INVALID);
+    }
+
+    for(i = 0; i < hdr.num_ratios; ++i) {
+        memcpy(&r, req->payload + sizeof(hdr) + i * sizeof(r), sizeof(r));
+        r = ntohl(r);
+        memcpy(&ratio, &r, sizeof(ratio));
+        if(ratio > 100 || ratio < 0) {
+            LOG(LL_INFO, "Invalid ratio - %.2f at %u", ratio, i);
+            return(PROTO_INVALID);
+        }
+    }
+
+    req->doc = req->payload + off;
+
+    return((int)hdr.num_ratios);
+}
+
+int
+send_replies(sock_context_t* s)
+{
+    request_t      * req;
+    int              res;
+
+    while(NULL != (req = s->out_head)) {
+
+        if(0 > (res = write_response(req))) {
+            return(handle_write_error(res, s));
+        } else if(0 == res) {
+            return(1); /* EAGAIN => wait till writable */
+        }
+
+        if(NULL == (s->out_head = req->next))
+            s->out_tail = NULL;
+
+        --s->num_inflight;
+
+        end_request(s, req, SMRZR_TRUE);
+        release_request(s, req);
+    }
+
+    return(1); /* 0 = closed */
+}
+
+void
+queue_reply(sock_context_t* s, request_t* req)
+{
+    req->next = NULL;
+
+    if(NULL == s->out_tail)
+        s->out_head = req;
+    else
+        s->out_tail->next = req;
+
+    s->out_tail = req;
+}
+
+void
+queue_job(request_t* req)
+{
+    req->next = NULL;
+    req->queued_at = now_usec();
+
+    pthread_mutex_lock(&g_jobs.lock);
+
+    if(NULL == g_jobs.tail)
+        g_jobs.head = req;
+    else
+        g_jobs.tail->next = req;
+
+    g_jobs.tail = req;
+
+    if(++g_jobs.depth > g_jobs.max_depth)
+        g_jobs.max_depth = g_jobs.depth;
+
+    pthread_cond_signal(&g_jobs.ready);
+
+    pthread_mutex_unlock(&g_jobs.lock);
+}
+
+int
+finish_jobs(worker_context_t* ctxt)
+{
+    request_t         * req, * next;
+    sock_context_t    * s;
+    int                 res;
+
+    pthread_mutex_lock(&ctxt->lock);
+
+    req = ctxt->done_head;
+    ctxt->done_head = ctxt->done_tail = NULL;
+
+    pthread_mutex_unlock(&ctxt->lock);
+
+    for(; NULL != req; req = next) {
+
+        next = req->next;
+        s = &g_socks[req->sock];
+
+        --s->num_computing;
+
+        if(SMRZR_TRUE == s->closing) {
+            end_request(s, req, SMRZR_FALSE);
+            release_request(NULL, req);
+            if(0 == s->num_computing)
+                release_sock(s);
+            continue;
+        }
+
+        queue_reply(s, req);
+
+        /* the socket won't report what came meanwhile again, so serve it
+           on till it would block */
+        if(0 > (res = serve_sock(s)))
+            return(res);
+    }
+
+    return(0);
+}
+
+void*
+computer(void* arg)
+{
+    computer_context_t* ctxt = (computer_context_t*)arg;
+    article_t           article;
+
+    if(SMRZR_OK != article_init(&article, g_huge_pages)) {
+        LOG(LL_ERROR, "Failed to init article for compute thread");
+        initiate_quit(EXIT_CANT_RECOVER);
+        pthread_exit(NULL);
+    }
+
+    computer_loop(ctxt, &g_lang, &article);
+
+    LOG(LL_NOTICE, "Graceful exit requested.. compute thread exiting");
+
+    article_destroy(&article);
+    pthread_exit(NULL);
+}
+
+void
+computer_loop(computer_context_t* ctxt, const lang_t* lang, article_t* article)
+{
+    request_t         * req;
+    worker_context_t  * w;
+    uint64_t            wait_us;
+
+    while(1) {
+
+        pthread_mutex_lock(&g_jobs.lock);
+
+        while(NULL == g_jobs.head && SMRZR_TRUE != g_jobs.quitting)
+            pthread_cond_wait(&g_jobs.ready, &g_jobs.lock);
+
+        if(SMRZR_TRUE == g_jobs.quitting) {
+            pthread_mutex_unlock(&g_jobs.lock);
+            return;
+        }
+
+        req = g_jobs.head;
+
+        if(NULL == (g_jobs.head = req->next))
+            g_jobs.tail = NULL;
+
+        --g_jobs.depth;
+        ++g_jobs.num_taken;
+
+        wait_us = now_usec() - req->queued_at;
+        g_jobs.wait_us += wait_us;
+        if(wait_us > g_jobs.max_wait_us)
+            g_jobs.max_wait_us = wait_us;
+
+        pthread_mutex_unlock(&g_jobs.lock);
+
+        LOG(LL_DEBUG, "Compute thread %d took request on %d after %lu usecs",
+                      ctxt->id, req->sock, (unsigned long)wait_us);
+
+        summarize(req, lang, article);
+
+        COUNTER_ADD(ctxt->num_jobs, 1);
+
+        /* back to the worker that owns the socket, which stays open and
+           with the worker till then */
+        w = &g_worker_contexts[g_socks[req->sock].worker];
+
+        pthread_mutex_lock(&w->lock);
+
+        req->next = NULL;
+
+        if(NULL == w->done_tail)
+            w->done_head = req;
+        else
+            w->done_tail->next = req;
+
+        w->done_tail = req;
+
+        pthread_mutex_unlock(&w->lock);
+
+        wake_worker(w);
+    }
+}
+
+void
+summarize(request_t* req, const lang_t* lang, article_t* article)
+{
+    float            ratio;
+    status_t         status;
+    analysis_t     * analysis;
+
+    memcpy(&ratio, &req->reqhdr.ratio, sizeof(ratio));
+    ratio = ratio / 100;
+
+    req->reply_len = 0;
+
+    if(NULL != (analysis = req->analysis)) {
+
+        LOG(LL_INFO, "Going to select from the analysis of %s for ratio %.2f",
+                      req->payload, ratio);
+
+        status = render_analysis(req, ratio);
+
+        req->analysis = NULL;
+        analysis_release(analysis);
+
+    } else if(SUMMARIZERD_VERSION_FILE == req->reqhdr.ver) {
+
+        LOG(LL_INFO, "Going to parse article %s for ratio %.2f",
+                      req->payload, ratio);
+
+        status = parse_article(req->payload, lang, article);
+
+    } else if(SUMMARIZERD_VERSION_RANKED == req->reqhdr.ver) {
+
+        LOG(LL_INFO, "Going to parse article of %u bytes for its ranking",
+                      req->reqhdr.payload_len);
+
+        status = parse_article_buffer(req->doc, req->reqhdr.payload_len -
+                                      (req->doc - req->payload), lang, article);
+
+    } else {
+
+        LOG(LL_INFO, "Going to parse article of %u bytes for ratio %.2f",
+                      req->reqhdr.payload_len, ratio);
+
+        /* the reply is kept till sent, so the document is not needed */
+        status = parse_article_buffer(req->doc, req->reqhdr.payload_len,
+                                      lang, article);
+    }
+
+    if(NULL != analysis) {
+        /* rendered already */
+    } else if(SUMMARIZERD_VERSION_RANKED == req->reqhdr.ver) {
+        status = status || rank_article(article, lang) ||
+                 render_ranked(req, article) || render_terms(req, article);
+    } else {
+        status = status || grade_article(article, lang, ratio) ||
+                 render_summary(req, article);
+    }
+
+    if(SMRZR_OK != status) {
+
+        LOG(LL_ERROR, "Failed to create summary of '%s' with ratio '%.2f'",
+                      SUMMARIZERD_VERSION_FILE == req->reqhdr.ver ?
+                      req->payload : "inline document", ratio);
+
+        req->rep_type = REP_ERROR_INTERNAL_ERROR;
+
+    } else if(SMRZR_TRUE == req->cacheable && SMRZR_TRUE == file_unchanged(req)) {
+        /* not cached if the file changed while it was read */
+        if(NULL == analysis)
+            analysis_insert(req, article);
+        cache_insert(req);
+    }
+
+    article_reset(article);
+}
+
+status_t
+render_summary(request_t* req, article_t* article)
+{
+    array_t     * a;
+    sentence_t  * sent;
+
+    a = article->sentences;
+
+    LOG(LL_DEBUG, "Number of sentences in article - %lu", ARR_SZ(a));
+
+    /* appended to the reply, after what is rendered already */
+    for(sent=(sentence_t*)ARR_FIRST(a); !ARR_END(a);
+        sent=(sentence_t*)ARR_NEXT(a))
+    {
+        if(!sent->is_selected) continue;
+
+        /* a sentence takes no more than its text and a newline */
+        if(SMRZR_OK != reserve_reply(req, (sent->end - sent->begin) + 2))
+            ERROR_RET;
+
+        req->reply_len += render_sentence(sent, req->reply + req->reply_len);
+    }
+
+    return(SMRZR_OK);
+}
+
+size_t
+render_sentence(const sentence_t* sent, string_t out)
+{
+    string_t      w;
+    size_t        len, out_len = 0;
+
+    /* only measured without out */
+    if(sent->is_para_begin) {
+        if(NULL != out) out[out_len] = '\n';
+        ++out_len;
+    }
+
+    w = sent->begin;
+
+    /* the words as in the document, a space after each */
+    while(w < sent->end) {
+
+        while(w < sent->end && IS_SPACE(*w)) ++w;
+
+        if(w >= sent->end) break;
+
+        for(len = 0; w + len < sent->end && !IS_SPACE(w[len]); ++len)
+            ;
+
+        if(NULL != out) {
+            memcpy(out + out_len, w, len);
+            out[out_len + len] = ' ';
+        }
+        out_len += len + 1;
+
+        w = w + len;
+    }
+
+    return(out_len);
+}
+
+status_t
+render_ranked(request_t* req, article_t* article)
+{
+    /* the replies, each framed, are sent together as one */
+    ranked_header_t          hdr;
+    batch_response_header_t  rephdr;
+    ranked_sentence_t        ranked;
+    sentence_t             * sentences;
+    uint32_t               * rank, i, r;
+    size_t                   off;
+    float                    ratio;
+    array_t                * a;
+
+    memcpy(&hdr, req->payload, sizeof(hdr));
+    hdr.flags = ntohl(hdr.flags);
+    hdr.num_ratios = ntohl(hdr.num_ratios);
+
+    rephdr.proto  = htons(SUMMARIZERD_PROTO);
+    rephdr.ver    = htons(SUMMARIZERD_VERSION_RANKED);
+    rephdr.status = htonl(REP_SUMMARY);
+    rephdr.id     = htonl(req->id);
+
+    for(i = 0; i < hdr.num_ratios; ++i) {
+
+        memcpy(&r, req->payload + sizeof(hdr) + i * sizeof(r), sizeof(r));
+        r = ntohl(r);
+        memcpy(&ratio, &r, sizeof(ratio));
+
+        select_sentences(article, ratio / 100);
+
+        if(SMRZR_OK != reserve_reply(req, sizeof(rephdr)))
+            ERROR_RET;
+
+        off = req->reply_len;
+        req->reply_len += sizeof(rephdr);
+
+        if(SMRZR_OK != render_summary(req, article))
+            ERROR_RET;
+
+        rephdr.index = htonl(i);
+        rephdr.summary_len = htonl(req->reply_len - off - sizeof(rephdr));
+        memcpy(req->reply + off, &rephdr, sizeof(rephdr));
+    }
+
+    if(!(hdr.flags & RANKED_WITH_RANKING))
+        return(SMRZR_OK);
+
+    a = article->ranking;
+
+    if(SMRZR_OK != reserve_reply(req, sizeof(rephdr) + ARR_SZ(a) * sizeof(ranked)))
+        ERROR_RET;
+
+    rephdr.index = htonl(hdr.num_ratios);
+    rephdr.summary_len = htonl(ARR_SZ(a) * sizeof(ranked));
+    memcpy(req->reply + req->reply_len, &rephdr, sizeof(rephdr));
+    req->reply_len += sizeof(rephdr);
+
+    sentences = (sentence_t*)ARR_AT(article->sentences, 0);
+
+    for(rank=(uint32_t*)ARR_FIRST(a); !ARR_END(a); rank=(uint32_t*)ARR_NEXT(a)) {
+        ranked.sentence = htonl(*rank);
+        ranked.num_words = htonl(sentences[*rank].num_words);
+        memcpy(req->reply + req->reply_len, &ranked, sizeof(ranked));
+        req->reply_len += sizeof(ranked);
+    }
+
+    return(SMRZR_OK);
+}
+
+status_t
+render_terms(request_t* req, article_t* article)
+{
+    /* framed as the ranking is, after its index even when it is not sent */
+    ranked_header_t          hdr;
+    batch_response_header_t  rephdr;
+    ranked_term_t            ranked;
+    string_t               * stems;
+    uint32_t               * counts, * term, max_terms;
+    size_t                   off, len;
+    array_t                * a;
+
+    memcpy(&hdr, req->payload, sizeof(hdr));
+    hdr.flags = ntohl(hdr.flags);
+    hdr.num_ratios = ntohl(hdr.num_ratios);
+
+    if(!(hdr.flags & RANKED_WITH_TERMS))
+        return(SMRZR_OK);
+
+    memcpy(&max_terms, req->payload + sizeof(hdr) +
+                       hdr.num_ratios * sizeof(uint32_t), sizeof(max_terms));
+
+    if(SMRZR_OK != rank_terms(article, ntohl(max_terms)) ||
+       SMRZR_OK != reserve_reply(req, sizeof(rephdr)))
+        ERROR_RET;
+
+    off = req->reply_len;
+    req->reply_len += sizeof(rephdr);
+
+    stems = (string_t*)ARR_AT(article->stems, 0);
+    counts = (uint32_t*)ARR_AT(article->counts, 0);
+
+    a = article->terms;
+
+    for(term=(uint32_t*)ARR_FIRST(a); !ARR_END(a); term=(uint32_t*)ARR_NEXT(a)) {
+
+        len = strlen(stems[*term]);
+
+        if(SMRZR_OK != reserve_reply(req, sizeof(ranked) + len))
+            ERROR_RET;
+
+        ranked.num_occ = htonl(counts[*term]);
+        ranked.stem_len = htonl(len);
+        memcpy(req->reply + req->reply_len, &ranked, sizeof(ranked));
+        memcpy(req->reply + req->reply_len + sizeof(ranked),
+               stems[*term], len);
+        req->reply_len += sizeof(ranked) + len;
+    }
+
+    rephdr.proto  = htons(SUMMARIZERD_PROTO);
+    rephdr.ver    = htons(SUMMARIZERD_VERSION_RANKED);
+    rephdr.status = htonl(REP_SUMMARY);
+    rephdr.id     = htonl(req->id);
+    rephdr.index  = htonl(hdr.num_ratios + 1);
+    rephdr.summary_len = htonl(req->reply_len - off - sizeof(rephdr));
+    memcpy(req->reply + off, &rephdr, sizeof(rephdr));
+
+    return(SMRZR_OK);
+}
+
+status_t
+reserve_reply(request_t* req, size_t len)
+{
+    string_t  reply;
+    size_t    need = req->reply_len + len;
+
+    if(need > req->reply_sz) {
+        if(need < 2 * req->reply_sz) need = 2 * req->reply_sz;
+        if(NULL == (reply = (string_t)realloc(req->reply, need)))
+            ERROR_RET;
+        req->reply = reply;
+        req->reply_sz = need;
+    }
+
+    return(SMRZR_OK);
+}
+
+bool_t
+cache_lookup(request_t* req)
+{
+    req->cacheable = SMRZR_FALSE;
+
+    if(NULL == g_cache.buckets && NULL == g_analyses.buckets)
+        return(SMRZR_FALSE);
+
+    /* left to the compute thread to report a file it can't read */
+    if(SMRZR_TRUE != stat_key(req->payload, req->reqhdr.ratio, &req->key))
+        return(SMRZR_FALSE);
+
+    req->cacheable = SMRZR_TRUE;
+
+    if(NULL != g_cache.buckets && SMRZR_TRUE == summary_lookup(req))
+        return(SMRZR_TRUE);
+
+    /* else summarized again, from the file's analysis if we have it */
+    req->analysis = analysis_lookup(req);
+
+    return(SMRZR_FALSE);
+}
+
+bool_t
+summary_lookup(request_t* req)
+{
+    cache_entry_t  * e;
+    string_t         reply;
+    bool_t           hit = SMRZR_FALSE;
+
+    pthread_mutex_lock(&g_cache.lock);
+
+    for(e = g_cache.buckets[cache_bucket(&req->key)]; NULL != e; e = e->hnext) {
+        if(e->key.dev == req->key.dev && e->key.ino == req->key.ino &&
+           e->key.ratio == req->key.ratio)
+            break;
+    }
+
+    if(NULL != e && SMRZR_TRUE != same_file(&e->key, &req->key)) {
+        LOG(LL_DEBUG, "Cached summary of %s is stale", req->payload);
+        cache_remove(e);
+        ++g_cache.stale;
+        e = NULL;
+    }
+
+    if(NULL != e && e->len > req->reply_sz) {
+        if(NULL == (reply = (string_t)realloc(req->reply, e->len))) {
+            LOG(LL_ERROR, "Can't allocate %lu bytes for cached summary", e->len);
+            e = NULL;
+        } else {
+            req->reply = reply;
+            req->reply_sz = e->len;
+        }
+    }
+
+    if(NULL != e) {
+        memcpy(req->reply, e->summary, e->len);
+        req->reply_len = e->len;
+
+        if(e != g_cache.head) { /* most recently used */
+            e->prev->next = e->next;
+            if(NULL == e->next)
+                g_cache.tail = e->prev;
+            else
+                e->next->prev = e->prev;
+            e->prev = NULL;
+            e->next = g_cache.head;
+            g_cache.head->prev = e;
+            g_cache.head = e;
+        }
+
+        ++g_cache.hits;
+        hit = SMRZR_TRUE;
+    } else {
+        ++g_cache.misses;
+    }
 
-                    LOG(LL_INFO, "Going to parse article %s for ratio %.2f",
-                                  s->filename, ratio);
+    pthread_mutex_unlock(&g_cache.lock);
 
-                    if(SMRZR_OK != (status =
-                        (parse_article(s->filename, lang, article)
-                         || grade_article(article, lang, ratio))))
-                    {
-                        LOG(LL_ERROR, "Failed to create summary of '%s' with ratio '%.2f'",
-                                      s->filename, ratio);
+    LOG(LL_DEBUG, "Summary cache %s for %s", (SMRZR_TRUE == hit) ?
+                  "hit" : "miss", req->payload);
+
+    return(hit);
+}
 
-                        article_reset(article);
+void
+cache_insert(const request_t* req)
+{
+    cache_entry_t  * e, * old;
+    size_t           size = sizeof(cache_entry_t) + req->reply_len;
 
-                        if(0 > (res = write_error_response(i, PROTO_INTERNAL_ERROR))) {
+    if(NULL == g_cache.buckets || size > g_cache.budget)
+        return;
 
-                            LOG(LL_ERROR, "Failed to send error response");
+    if(NULL == (e = (cache_entry_t*)malloc(size))) {
+        LOG(LL_WARN, "Can't allocate %lu bytes to cache a summary", size);
+        return;
+    }
 
-                            if(0 >= (res = handle_write_error(res, ctxt, s))) 
-                                return(res);
+    e->key = req->key;
+    e->summary = (string_t)(e + 1);
+    e->len = req->reply_len;
+    memcpy(e->summary, req->reply, e->len);
 
-                        } else if(res > 0) { /* done writing */
-                            s->status = SOCK_READ;
-                        } /* else [ res = 0 => EAGAIN => try select again ] */
+    pthread_mutex_lock(&g_cache.lock);
 
-                    } else {
+    /* another compute thread may have summarized it meanwhile */
+    for(old = g_cache.buckets[cache_bucket(&req->key)]; NULL != old;
+        old = old->hnext) {
+        if(old->key.dev == req->key.dev && old->key.ino == req->key.ino &&
+           old->key.ratio == req->key.ratio) {
+            cache_remove(old);
+            break;
+        }
+    }
 
-                        if(0 > (res = write_summary_response(i, article))) {
+    while(g_cache.bytes + size > g_cache.budget) {
+        cache_remove(g_cache.tail);
+        ++g_cache.evicted;
+    }
 
-                            LOG(LL_ERROR, "Failed to send summary of '%s' with ratio '%.2f'",
-                                      s->filename, ratio);
+    e->hnext = g_cache.buckets[cache_bucket(&req->key)];
+    g_cache.buckets[cache_bucket(&req->key)] = e;
 
-                            article_reset(article);
+    e->prev = NULL;
+    e->next = g_cache.head;
+    if(NULL == g_cache.head)
+        g_cache.tail = e;
+    else
+        g_cache.head->prev = e;
+    g_cache.head = e;
 
-                            if(0 >= (res = handle_write_error(res, ctxt, s)))
-                                return(res);
+    ++g_cache.num_entries;
+    g_cache.bytes += size;
 
-                        } else if(res > 0) { /* sent response properly */
-                            s->status = SOCK_READ;
-                        } /* else [ res = 0 => EAGAIN => try select again ] */
-                    }
+    pthread_mutex_unlock(&g_cache.lock);
+}
 
-                    article_reset(article);
+void
+cache_remove(cache_entry_t* e)
+{
+    cache_entry_t ** p;
 
-                } else {
-                    if( 0 > (res = write_error_response(i, s->rep_type))) {
+    /* caller holds the lock */
+    for(p = &g_cache.buckets[cache_bucket(&e->key)]; *p != e; p = &(*p)->hnext)
+        ;
+    *p = e->hnext;
 
-                        LOG(LL_ERROR, "Failed to send error response");
+    if(NULL == e->prev)
+        g_cache.head = e->next;
+    else
+        e->prev->next = e->next;
 
-                        if(0 >= (res = handle_write_error(res, ctxt, s)))
-                            return(res);
+    if(NULL == e->next)
+        g_cache.tail = e->prev;
+    else
+        e->next->prev = e->prev;
 
-                    } else if(res > 0) { /* done writing */
-                        s->status = SOCK_READ;
-                    } /* else [ res = 0 => EAGAIN => try select again ] */
-                }
-            }
+    --g_cache.num_entries;
+    g_cache.bytes -= sizeof(cache_entry_t) + e->len;
+
+    free(e);
+}
+
+size_t
+cache_bucket(const cache_key_t* key)
+{
+    uint64_t h;
+
+    h = ((uint64_t)key->ino * 0x9e3779b97f4a7c15ULL) ^
+        ((uint64_t)key->dev << 32) ^ key->ratio;
+    h ^= h >> 29;
+
+    return((size_t)(h & (CACHE_BUCKETS - 1)));
+}
+
+bool_t
+stat_key(literal_t file, uint32_t ratio, cache_key_t* key)
+{
+    struct stat  st;
+
+    if(0 != stat(file, &st))
+        return(SMRZR_FALSE);
+
+    memset(key, 0, sizeof(cache_key_t));
+    key->dev = st.st_dev;
+    key->ino = st.st_ino;
+    key->mtime = st.st_mtim;
+    key->size = st.st_size;
+    key->ratio = ratio;
+
+    return(SMRZR_TRUE);
+}
+
+bool_t
+same_file(const cache_key_t* a, const cache_key_t* b)
+{
+    return((a->dev == b->dev && a->ino == b->ino && a->size == b->size &&
+            a->mtime.tv_sec == b->mtime.tv_sec &&
+            a->mtime.tv_nsec == b->mtime.tv_nsec) ? SMRZR_TRUE : SMRZR_FALSE);
+}
+
+bool_t
+file_unchanged(const request_t* req)
+{
+    cache_key_t  key;
+
+    return((SMRZR_TRUE == stat_key(req->payload, req->reqhdr.ratio, &key) &&
+            SMRZR_TRUE == same_file(&key, &req->key)) ? SMRZR_TRUE : SMRZR_FALSE);
+}
+
+analysis_t*
+analysis_lookup(const request_t* req)
+{
+    analysis_t     * a;
+
+    if(NULL == g_analyses.buckets)
+        return(NULL);
+
+    pthread_mutex_lock(&g_analyses.lock);
+
+    for(a = g_analyses.buckets[analysis_bucket(&req->key)]; NULL != a;
+        a = a->hnext) {
+        if(a->key.dev == req->key.dev && a->key.ino == req->key.ino)
+            break;
+    }
+
+    /* changed, and the watch didn't tell us yet */
+    if(NULL != a && SMRZR_TRUE != same_file(&a->key, &req->key)) {
+        LOG(LL_DEBUG, "Analysis of %s is stale", req->payload);
+        analysis_remove(a);
+        analysis_unref(a);
+        ++g_analyses.stale;
+        a = NULL;
+    }
+
+    if(NULL != a) {
+        if(a != g_analyses.head) { /* most recently used */
+            a->prev->next = a->next;
+            if(NULL == a->next)
+                g_analyses.tail = a->prev;
+            else
+                a->next->prev = a->prev;
+            a->prev = NULL;
+            a->next = g_analyses.head;
+            g_analyses.head->prev = a;
+            g_analyses.head = a;
         }
+
+        ++a->refs;
+        ++g_analyses.hits;
+    } else {
+        ++g_analyses.misses;
     }
 
-    return(0);
+    pthread_mutex_unlock(&g_analyses.lock);
+
+    LOG(LL_DEBUG, "Analysis cache %s for %s", (NULL != a) ?
+                  "hit" : "miss", req->payload);
+
+    return(a);
+}
+
+void
+analysis_insert(const request_t* req, article_t* article)
+{
+    analysis_t     * a, * old;
+    sentence_t     * sent, * sentences;
+    uint32_t       * rank;
+    array_t        * arr;
+    size_t           i, n, text_len = 0, size;
+
+    if(NULL == g_analyses.buckets)
+        return;
+
+    arr = article->sentences;
+    n = ARR_SZ(arr);
+
+    for(sent=(sentence_t*)ARR_FIRST(arr); !ARR_END(arr);
+        sent=(sentence_t*)ARR_NEXT(arr))
+        text_len += render_sentence(sent, NULL);
+
+    size = sizeof(analysis_t) + n * (sizeof(analyzed_sentence_t) +
+                                     sizeof(uint32_t)) + text_len;
+
+    if(size > g_analyses.budget)
+        return;
+
+    if(NULL == (a = (analysis_t*)malloc(size))) {
+        LOG(LL_WARN, "Can't allocate %lu bytes to cache an analysis", size);
+        return;
+    }
+
+    a->key = req->key;
+    a->key.ratio = 0;
+    a->refs = 1;
+    a->size = size;
+    a->num_words = article->num_words;
+    a->num_sentences = n;
+    a->sentences = (analyzed_sentence_t*)(a + 1);
+    a->ranking = (uint32_t*)(a->sentences + n);
+    a->text = (string_t)(a->ranking + n);
+
+    sentences = (sentence_t*)ARR_AT(arr, 0);
+    text_len = 0;
+
+    for(i = 0; i < n; ++i) {
+        a->sentences[i].offset = text_len;
+        a->sentences[i].len = render_sentence(&sentences[i], a->text + text_len);
+        a->sentences[i].num_words = sentences[i].num_words;
+        text_len += a->sentences[i].len;
+    }
+
+    arr = article->ranking;
+    i = 0;
+    for(rank=(uint32_t*)ARR_FIRST(arr); !ARR_END(arr); rank=(uint32_t*)ARR_NEXT(arr))
+        a->ranking[i++] = *rank;
+
+    a->wd = (0 > g_watch_fd) ? -1 :
+            inotify_add_watch(g_watch_fd, req->payload, WATCH_EVENTS);
+
+    pthread_mutex_lock(&g_analyses.lock);
+
+    /* another compute thread may have parsed it meanwhile, with the same
+       watch, as the file is the same */
+    for(old = g_analyses.buckets[analysis_bucket(&a->key)]; NULL != old;
+        old = old->hnext) {
+        if(old->key.dev == a->key.dev && old->key.ino == a->key.ino) {
+            if(old->wd == a->wd)
+                old->wd = -1;
+            analysis_remove(old);
+            analysis_unref(old);
+            break;
+        }
+    }
+
+    while(g_analyses.bytes + size > g_analyses.budget) {
+        old = g_analyses.tail;
+        analysis_remove(old);
+        analysis_unref(old);
+        ++g_analyses.evicted;
+    }
+
+    a->hnext = g_analyses.buckets[analysis_bucket(&a->key)];
+    g_analyses.buckets[analysis_bucket(&a->key)] = a;
+
+    a->prev = NULL;
+    a->next = g_analyses.head;
+    if(NULL == g_analyses.head)
+        g_analyses.tail = a;
+    else
+        g_analyses.head->prev = a;
+    g_analyses.head = a;
+
+    ++g_analyses.num_entries;
+    g_analyses.bytes += size;
+
+    pthread_mutex_unlock(&g_analyses.lock);
+}
+
+void
+analysis_remove(analysis_t* a)
+{
+    analysis_t ** p;
+
+    /* caller holds the lock, and then the cache's ref */
+    for(p = &g_analyses.buckets[analysis_bucket(&a->key)]; *p != a;
+        p = &(*p)->hnext)
+        ;
+    *p = a->hnext;
+
+    if(NULL == a->prev)
+        g_analyses.head = a->next;
+    else
+        a->prev->next = a->next;
+
+    if(NULL == a->next)
+        g_analyses.tail = a->prev;
+    else
+        a->next->prev = a->prev;
+
+    if(0 <= a->wd)
+        inotify_rm_watch(g_watch_fd, a->wd);
+
+    --g_analyses.num_entries;
+    g_analyses.bytes -= a->size;
+}
+
+void
+analysis_release(analysis_t* a)
+{
+    pthread_mutex_lock(&g_analyses.lock);
+
+    analysis_unref(a);
+
+    pthread_mutex_unlock(&g_analyses.lock);
+}
+
+void
+analysis_unref(analysis_t* a)
+{
+    /* caller holds the lock */
+    if(0 == --a->refs)
+        free(a);
+}
+
+status_t
+render_analysis(request_t* req, float ratio)
+{
+    analysis_t     * a = req->analysis;
+    analyzed_sentence_t* sent;
+    char           * selected;
+    ssize_t          max_words;
+    size_t           i, len = 0;
+
+    if(NULL == (selected = (char*)calloc(a->num_sentences + 1, 1)))
+        ERROR_RET;
+
+    /* as select_sentences, then in the document's order */
+    max_words = a->num_words * ratio;
+
+    for(i = 0; i < a->num_sentences && max_words > 0; ++i) {
+        sent = &a->sentences[a->ranking[i]];
+        selected[a->ranking[i]] = 1;
+        len += sent->len;
+        max_words -= sent->num_words;
+    }
+
+    if(SMRZR_OK != reserve_reply(req, len)) {
+        free(selected);
+        ERROR_RET;
+    }
+
+    for(i = 0; i < a->num_sentences; ++i) {
+        if(!selected[i]) continue;
+        sent = &a->sentences[i];
+        memcpy(req->reply + req->reply_len, a->text + sent->offset, sent->len);
+        req->reply_len += sent->len;
+    }
+
+    free(selected);
+
+    return(SMRZR_OK);
+}
+
+void
+handle_watch_events(void)
+{
+    char                    buf[4096]
+                            __attribute__((aligned(__alignof__(struct inotify_event))));
+    struct inotify_event  * ev;
+    ssize_t                 len;
+    char                  * p;
+
+    while(0 < (len = read(g_watch_fd, buf, sizeof(buf)))) {
+        for(p = buf; p < buf + len; p += sizeof(struct inotify_event) + ev->len) {
+            ev = (struct inotify_event*)p;
+            drop_watched(ev->wd, (ev->mask & IN_IGNORED) ?
+                                 SMRZR_FALSE : SMRZR_TRUE);
+        }
+    }
+
+    if(0 > len && EAGAIN != errno && EINTR != errno)
+        LOG(LL_ERROR, "Can't read watch events - %s", strerror(errno));
+}
+
+void
+drop_watched(int wd, bool_t is_watched)
+{
+    analysis_t     * a;
+    cache_entry_t  * e, * next;
+    cache_key_t      key;
+
+    pthread_mutex_lock(&g_analyses.lock);
+
+    for(a = g_analyses.head; NULL != a && a->wd != wd; a = a->next)
+        ;
+
+    if(NULL != a) {
+        key = a->key;
+        if(SMRZR_TRUE != is_watched)
+            a->wd = -1; /* gone with the file */
+        analysis_remove(a);
+        analysis_unref(a);
+        ++g_analyses.dropped;
+    }
+
+    pthread_mutex_unlock(&g_analyses.lock);
+
+    if(NULL == a)
+        return; /* removed before the event came */
+
+    LOG(LL_DEBUG, "Dropping what is cached of changed file %lu:%lu",
+                  (unsigned long)key.dev, (unsigned long)key.ino);
+
+    /* and its summaries, at any ratio */
+    if(NULL == g_cache.buckets)
+        return;
+
+    pthread_mutex_lock(&g_cache.lock);
+
+    for(e = g_cache.head; NULL != e; e = next) {
+        next = e->next;
+        if(e->key.dev == key.dev && e->key.ino == key.ino)
+            cache_remove(e);
+    }
+
+    pthread_mutex_unlock(&g_cache.lock);
+}
+
+size_t
+analysis_bucket(const cache_key_t* key)
+{
+    uint64_t h;
+
+    h = ((uint64_t)key->ino * 0x9e3779b97f4a7c15ULL) ^ ((uint64_t)key->dev << 32);
+    h ^= h >> 29;
+
+    return((size_t)(h & (CACHE_BUCKETS - 1)));
+}
+
+uint64_t
+now_usec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return((uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+}
+
+int
+write_response(request_t* req)
+{
+    struct iovec     iov[2];
+    size_t           off;
+    int              res, iovcnt = 0;
+
+    if(0 == req->rep_len) { /* not tried yet */
+        if(REP_SUMMARY == req->rep_type)
+            prepare_summary_response(req);
+        else
+            prepare_error_response(req);
+    }
+
+    /* whatever was sent before would block is not sent again */
+    off = req->rep_offset;
+
+    if(off < req->rephdr_len) {
+        iov[iovcnt].iov_base = (char*)&req->rephdr + off;
+        iov[iovcnt].iov_len = req->rephdr_len - off;
+        ++iovcnt;
+        off = 0;
+    } else {
+        off -= req->rephdr_len;
+    }
+
+    if(req->rep_len > req->rephdr_len) {
+        iov[iovcnt].iov_base = req->reply + off;
+        iov[iovcnt].iov_len = req->rep_len - req->rephdr_len - off;
+        ++iovcnt;
+    }
+
+    if(0 > (res = write_nb(req->sock, iov, iovcnt))) {
+        LOG(LL_ERROR, "Failed to send %s response",
+                      (REP_SUMMARY == req->rep_type) ? "summary" : "error");
+        return(res);
+    }
+
+    req->rep_offset += res;
+
+    if(req->rep_offset < req->rep_len)
+        return(0); /* EAGAIN */
+
+    return(1);
 }
 
 int
 read_summary_request(sock_context_t* ctxt)
 {
     /* request
-     * proto[2] | ver[2] | ratio[4] | filename_len[4] | filename[filename_len] |
+     * proto[2] | ver[2] | ratio[4] | payload_len[4] | payload[payload_len] |
+     * proto[2] | ver[2] | ratio[4] | payload_len[4] | id[4] | payload[payload_len] |
+     *
+     * payload is the filename for version 1, the document for version 2
+     * and 3, a batch of them for version 4, ratios and a document for
+     * version 5, the latter three with an id; any of it may arrive over
+     * several reads, req_offset tracks the progress
      */
     int              res;
     float            ratio;
-    uint32_t         r;
-    request_header_t reqhdr;
+    uint32_t         r, max_len;
+    size_t           len, hdr_len = sizeof(request_header_t);
+    string_t         payload;
+    request_t      * req = ctxt->in;
+    request_header_t* reqhdr = &req->reqhdr;
 
-    if(0 == ctxt->req_offset) {
+    if(ctxt->req_offset < hdr_len) {
 
-        if(sizeof(reqhdr) != (res = read_nb(ctxt->sock, &reqhdr, sizeof(reqhdr)))) {
+        if(0 > (res = read_nb(ctxt->sock, (char*)reqhdr + ctxt->req_offset,
+                              hdr_len - ctxt->req_offset))) {
             return(res);
         }
 
-        ctxt->req_offset = sizeof(reqhdr);
+        ctxt->req_offset += res;
+
+        if(ctxt->req_offset < hdr_len)
+            return(0); /* EAGAIN */
+
+        reqhdr->proto = ntohs(reqhdr->proto);
+        reqhdr->ver = ntohs(reqhdr->ver);
+        reqhdr->ratio = ntohl(reqhdr->ratio);
+        reqhdr->payload_len = ntohl(reqhdr->payload_len);
+    }
+
+    if(IS_PIPELINED(reqhdr->ver)) {
+
+        hdr_len += sizeof(uint32_t);
+
+        if(ctxt->req_offset < hdr_len) {
+
+            if(0 > (res = read_nb(ctxt->sock, (char*)&req->id +
+                                  ctxt->req_offset - sizeof(request_header_t),
+                                  hdr_len - ctxt->req_offset))) {
+                return(res);
+            }
+
+            ctxt->req_offset += res;
+
+            if(ctxt->req_offset < hdr_len)
+                return(0); /* EAGAIN */
+
+            req->id = ntohl(req->id);
+        }
+    }
+
+    if(ctxt->req_offset == hdr_len) { /* checked again if no payload yet */
 
-        reqhdr.proto = ntohs(reqhdr.proto);
-        reqhdr.ver = ntohs(reqhdr.ver);
-        reqhdr.ratio = ntohl(reqhdr.ratio);
-        reqhdr.filename_len = ntohl(reqhdr.filename_len);
+        ctxt->req_offset = 0; /* header is consumed even if invalid */
 
-        if(SUMMARIZERD_PROTO != reqhdr.proto) {
+        if(SUMMARIZERD_PROTO != reqhdr->proto) {
             LOG(LL_INFO, "Server protocol - %u, Client protocol - %u",
-                SUMMARIZERD_PROTO, reqhdr.proto);
+                SUMMARIZERD_PROTO, reqhdr->proto);
             return(PROTO_INVALID);
         }
 
-        if(SUMMARIZERD_VERSION != reqhdr.ver) {
+        if(SUMMARIZERD_VERSION_FILE != reqhdr->ver &&
+           SUMMARIZERD_VERSION_INLINE != reqhdr->ver &&
+           !IS_PIPELINED(reqhdr->ver)) {
             LOG(LL_INFO, "Server version - %u, Client version - %u",
-                SUMMARIZERD_VERSION, reqhdr.ver);
+                SUMMARIZERD_VERSION, reqhdr->ver);
             return(PROTO_INVALID);
         }
 
-        r = reqhdr.ratio;
+        r = reqhdr->ratio;
 
         ratio = *((float*)(void*)&r);
 
-        if(ratio > 100 || ratio < 0) {
+        /* a batch has a ratio for each item instead, a ranked request
+           a list of them */
+        if(!IS_INDEXED(reqhdr->ver) &&
+           (ratio > 100 || ratio < 0)) {
             LOG(LL_INFO, "Invalid ratio - %.2f", ratio);
             return(PROTO_INVALID);
         }
 
-        if(reqhdr.filename_len > MAX_FILENAME_LEN) {
-            LOG(LL_INFO, "Too long filename - %u", reqhdr.filename_len);
+        max_len = (SUMMARIZERD_VERSION_FILE == reqhdr->ver) ? MAX_FILENAME_LEN :
+                  (SUMMARIZERD_VERSION_BATCH == reqhdr->ver) ? MAX_BATCH_LEN :
+                  (SUMMARIZERD_VERSION_RANKED == reqhdr->ver) ? MAX_RANKED_LEN :
+                  MAX_DOCUMENT_LEN;
+
+        if(reqhdr->payload_len > max_len) {
+            LOG(LL_INFO, "Too long %s - %u",
+                (SUMMARIZERD_VERSION_FILE == reqhdr->ver) ? "filename" :
+                (SUMMARIZERD_VERSION_BATCH == reqhdr->ver) ? "batch" : "document",
+                reqhdr->payload_len);
             return(PROTO_INVALID);
         }
 
-        memcpy(&ctxt->reqhdr, &reqhdr, sizeof(request_header_t));
+        /* the receive buffer is kept for a later request on this socket */
+        if(reqhdr->payload_len + 1 > req->payload_sz) {
+            if(NULL == (payload = (string_t)realloc(req->payload,
+                                                    reqhdr->payload_len + 1))) {
+                LOG(LL_ERROR, "Can't allocate %u bytes for request payload",
+                    reqhdr->payload_len + 1);
+                return(PROTO_INTERNAL_ERROR);
+            }
+            req->payload = payload;
+            req->payload_sz = reqhdr->payload_len + 1;
+        }
+
+        ctxt->req_offset = hdr_len;
     }
 
-    if((int)ctxt->reqhdr.filename_len !=
-       (res = read_nb(ctxt->sock, ctxt->filename, ctxt->reqhdr.filename_len)))
-    {
-        return(res);
+    len = ctxt->req_offset - hdr_len;
+
+    if(len < reqhdr->payload_len) {
+
+        if(0 > (res = read_nb(ctxt->sock, req->payload + len,
+                              reqhdr->payload_len - len))) {
+            return(res);
+        }
+
+        ctxt->req_offset += res;
+
+        if(len + res < reqhdr->payload_len)
+            return(0); /* EAGAIN */
     }
 
+    req->payload[reqhdr->payload_len] = 0;
+
     ctxt->req_offset = 0;
-    ctxt->status = SOCK_WRITE; /* req read, ready to write */
 
     LOG(LL_DEBUG, "Read request on socket %d", ctxt->sock);
 
-    LOG(LL_DEBUG, "File to create summary for - %s", ctxt->filename);
+    if(SUMMARIZERD_VERSION_FILE == reqhdr->ver)
+        LOG(LL_DEBUG, "File to create summary for - %s", req->payload);
+    else if(SUMMARIZERD_VERSION_BATCH == reqhdr->ver)
+        LOG(LL_DEBUG, "Batch to create summaries for - %u bytes (id %u)",
+                      reqhdr->payload_len, req->id);
+    else
+        LOG(LL_DEBUG, "Document to create summary for - %u bytes (id %u)",
+                      reqhdr->payload_len, req->id);
 
     return(1); /* 0 = EAGAIN */
 }
@@ -1118,12 +3222,13 @@ read_nb(int sock, void* buf, size_t len)
                         LOG(LL_FATAL, "recv: signal %d", g_sig);
                         return(EXIT_CANT_RECOVER);
                 }
-            case ECONNREFUSED:
-                LOG(LL_INFO, "recv: conn refused (client may have died)");
+            case ECONNREFUSED: case ECONNRESET:
+                LOG(LL_INFO, "recv: conn refused/reset (client may have died)");
                 return(PROTO_PEER_LOST);
-            BLOCKCASES: /* no more to read */
-                LOG(LL_DEBUG, "recv: nothing to read");
-                return(0);
+            BLOCKCASES: /* no more to read, caller resumes later */
+                LOG(LL_DEBUG, "recv: nothing more to read, read %d",
+                              total_len);
+                return(total_len);
             default:
                 LOG(LL_FATAL, "recv: %s", strerror(errno));
                 return(EXIT_CANT_RECOVER);
@@ -1135,128 +3240,138 @@ read_nb(int sock, void* buf, size_t len)
     return(total_len);
 }
 
-int
-write_summary_response(int sock, article_t* article)
+uint16_t
+response_version(const request_t* req)
 {
-    /* response
-     * proto[2] | ver[2] | status[4] | summary_len[4] | summary[filename_len] |
-     */
-
-    array_t     * a;
-    sentence_t  * s;
-    string_t      w;
-    size_t        len = 0;
-    int           res;
+    /* replies are in the version of the request, if we know it */
+    if(SUMMARIZERD_VERSION_FILE == req->reqhdr.ver ||
+       SUMMARIZERD_VERSION_INLINE == req->reqhdr.ver ||
+       IS_PIPELINED(req->reqhdr.ver))
+        return(req->reqhdr.ver);
 
-    response_header_t rephdr;
-
-    a = article->sentences;
-
-    LOG(LL_DEBUG, "Number of sentences in article - %lu", ARR_SZ(a));
-
-    for(s=(sentence_t*)ARR_FIRST(a); !ARR_END(a); s=(sentence_t*)ARR_NEXT(a)) {
-
-        if(s->is_selected) {
-
-            LOG(LL_DEBUG, "Found a selected article");
-
-            if(s->is_para_begin) ++len; /* fprintf(stdout, "\n"); */
-
-            w = s->begin;
-
-            while(w < s->end) {
+    return(SUMMARIZERD_VERSION);
+}
 
-                while(0 == *w && w < s->end) ++w;
-    
-                if(w >= s->end) break;
-    
-                len += (strlen(w) + 1); /* fprintf(stdout, "%s ", w); */
-    
-                w = w + strlen(w);
-            }
-        }
+void
+prepare_summary_response(request_t* req)
+{
+    /* response
+     * proto[2] | ver[2] | status[4] | summary_len[4] | summary[summary_len] |
+     * proto[2] | ver[2] | status[4] | id[4] | summary_len[4] | summary[summary_len] |
+     * proto[2] | ver[2] | status[4] | id[4] | index[4] | summary_len[4] | summary[summary_len] |
+     *
+     * the last, for version 5, once for each ratio and the ranking, all
+     * rendered in the summary
+     */
+    response_header_t         rephdr;
+    tagged_response_header_t  tagged;
+    batch_response_header_t   batch;
+
+    if(SUMMARIZERD_VERSION_RANKED == response_version(req)) {
+        req->rephdr_len = 0; /* rendered framed */
+    } else if(SUMMARIZERD_VERSION_BATCH == response_version(req)) {
+        batch.proto  = htons(SUMMARIZERD_PROTO);
+        batch.ver    = htons(SUMMARIZERD_VERSION_BATCH);
+        batch.status = htonl(REP_SUMMARY);
+        batch.id     = htonl(req->id);
+        batch.index  = htonl(req->index);
+        batch.summary_len = htonl(req->reply_len);
+        memcpy(&req->rephdr, &batch, sizeof(batch));
+        req->rephdr_len = sizeof(batch);
+    } else if(SUMMARIZERD_VERSION_TAGGED == response_version(req)) {
+        tagged.proto  = htons(SUMMARIZERD_PROTO);
+        tagged.ver    = htons(SUMMARIZERD_VERSION_TAGGED);
+        tagged.status = htonl(REP_SUMMARY);
+        tagged.id     = htonl(req->id);
+        tagged.summary_len = htonl(req->reply_len);
+        memcpy(&req->rephdr, &tagged, sizeof(tagged));
+        req->rephdr_len = sizeof(tagged);
+    } else {
+        rephdr.proto  = htons(SUMMARIZERD_PROTO);
+        rephdr.ver    = htons(response_version(req));
+        rephdr.status = htonl(REP_SUMMARY);
+        rephdr.summary_len = htonl(req->reply_len);
+        memcpy(&req->rephdr, &rephdr, sizeof(rephdr));
+        req->rephdr_len = sizeof(rephdr);
     }
 
-    rephdr.proto  = htons(SUMMARIZERD_PROTO);
-    rephdr.ver    = htons(SUMMARIZERD_VERSION);
-    rephdr.status = htonl(REP_SUMMARY);
-    rephdr.summary_len = htonl(len);
+    req->rep_len = req->rephdr_len + req->reply_len;
+    req->rep_offset = 0;
 
     LOG(LL_INFO, "Sending summary response (%lu bytes) on %d",
-                 len + sizeof(rephdr), sock);
-
-    if(sizeof(rephdr) != (res = write_nb(sock, &rephdr, sizeof(rephdr)))) {
-        return(res);
-    }
-
-    for(s=(sentence_t*)ARR_FIRST(a); !ARR_END(a); s=(sentence_t*)ARR_NEXT(a)) {
-
-        if(s->is_selected) {
-
-            if(s->is_para_begin)
-                if(1 != (res = write_nb(sock, "\n", 1))) return res;
-
-            w = s->begin;
-
-            while(w < s->end) {
-
-                while(0 == *w && w < s->end) ++w;
-    
-                if(w >= s->end) break;
-    
-                if((int)strlen(w) != (res = write_nb(sock, w, strlen(w))))
-                    return res;
-
-                if(1 != (res = write_nb(sock, " ", 1))) return res;
-    
-                w = w + strlen(w);
-            }
-        }
-    }
-
-    return(1); /* 0 == EAGAIN */
+                 req->rep_len, req->sock);
 }
 
-int
-write_error_response(int sock, int err)
+void
+prepare_error_response(request_t* req)
 {
     /* response
      * proto[2] | ver[2] | status[4] | -- error case
+     * proto[2] | ver[2] | status[4] | id[4] | -- error case
+     * proto[2] | ver[2] | status[4] | id[4] | index[4] | -- error case
      */
-    int               res;
-    size_t            len;
-    error_header_t    rephdr;
-
-    rephdr.proto  = htons(SUMMARIZERD_PROTO);
-    rephdr.ver    = htons(SUMMARIZERD_VERSION);
-    rephdr.status = htonl((int)err);
+    error_header_t         rephdr;
+    tagged_error_header_t  tagged;
+    batch_error_header_t   batch;
+
+    if(IS_INDEXED(response_version(req))) {
+        batch.proto  = htons(SUMMARIZERD_PROTO);
+        batch.ver    = htons(response_version(req));
+        batch.status = htonl((int)req->rep_type);
+        batch.id     = htonl(req->id);
+        batch.index  = htonl(req->index);
+        memcpy(&req->rephdr, &batch, sizeof(batch));
+        req->rephdr_len = sizeof(batch);
+    } else if(SUMMARIZERD_VERSION_TAGGED == response_version(req)) {
+        tagged.proto  = htons(SUMMARIZERD_PROTO);
+        tagged.ver    = htons(SUMMARIZERD_VERSION_TAGGED);
+        tagged.status = htonl((int)req->rep_type);
+        tagged.id     = htonl(req->id);
+        memcpy(&req->rephdr, &tagged, sizeof(tagged));
+        req->rephdr_len = sizeof(tagged);
+    } else {
+        rephdr.proto  = htons(SUMMARIZERD_PROTO);
+        rephdr.ver    = htons(response_version(req));
+        rephdr.status = htonl((int)req->rep_type);
+        memcpy(&req->rephdr, &rephdr, sizeof(rephdr));
+        req->rephdr_len = sizeof(rephdr);
+    }
 
-    len = sizeof(rephdr);
+    req->rep_len = req->rephdr_len;
+    req->rep_offset = 0;
 
     LOG(LL_INFO, "Sending error response (error %d, %lu bytes) on %d",
-                 err, len, sock);
-
-    if((int)len != (res = write_nb(sock, &rephdr, len))) {
-        return(res);
-    }
-
-    return(1);
+                 req->rep_type, req->rep_len, req->sock);
 }
 
 int
-write_nb(int sock, const void* buf, size_t len)
+write_nb(int sock, struct iovec* iov, int iovcnt)
 {
-    int     wrote_len, total_len = 0;
+    ssize_t wrote_len;
+    size_t  len = 0;
+    int     i, total_len = 0;
+
+    for(i = 0; i < iovcnt; ++i)
+        len += iov[i].iov_len;
 
     LOG(LL_DEBUG, "To write total of %lu bytes", len);
 
     while(len) {
 
-        if(0 < (wrote_len = send(sock, buf, len, 0))) {
+        if(0 < (wrote_len = writev(sock, iov, iovcnt))) {
             len -= wrote_len;
-            buf += wrote_len;
             total_len += wrote_len;
-            LOG(LL_DEBUG, "Wrote %d, remaining %lu", wrote_len, len);
+            LOG(LL_DEBUG, "Wrote %ld, remaining %lu", (long)wrote_len, len);
+
+            /* step over what was written */
+            while(iovcnt && (size_t)wrote_len >= iov->iov_len) {
+                wrote_len -= iov->iov_len;
+                ++iov; --iovcnt;
+            }
+            if(iovcnt) {
+                iov->iov_base = (char*)iov->iov_base + wrote_len;
+                iov->iov_len -= wrote_len;
+            }
         } else
         if(0 > wrote_len) {
             switch(errno) {
@@ -1275,9 +3390,9 @@ write_nb(int sock, const void* buf, size_t len)
             case ECONNRESET: case EPIPE:
                 LOG(LL_INFO, "send: conn reset/pipe (client may have died)");
                 return(PROTO_PEER_LOST);
-            BLOCKCASES:
-                LOG(LL_DEBUG, "send: not ready to write");
-                return(0);
+            BLOCKCASES: /* no room for more, caller resumes later */
+                LOG(LL_DEBUG, "send: not ready to write, wrote %d", total_len);
+                return(total_len);
             default:
                 LOG(LL_FATAL, "send: %s", strerror(errno));
                 return(EXIT_CANT_RECOVER);
@@ -1293,42 +3408,52 @@ write_nb(int sock, const void* buf, size_t len)
 }
 
 int
-handle_select_error(void)
+handle_wait_error(void)
 {
     if(EINTR == errno) { /* signal */
-        LOG(LL_INFO, "select: interrupted by signal");
+        LOG(LL_INFO, "epoll_wait: interrupted by signal");
         switch(g_sig) {
             TERMSIGCASES:
-                LOG(LL_NOTICE, "select: term signal %d", g_sig);
+                LOG(LL_NOTICE, "epoll_wait: term signal %d", g_sig);
                 return(EXIT_OK);
             CRASHSIGCASES:
-                LOG(LL_CRIT, "select: crash signal %d", g_sig);
+                LOG(LL_CRIT, "epoll_wait: crash signal %d", g_sig);
                 return(EXIT_CRASH);
             default:
-                LOG(LL_FATAL, "select: signal %d", g_sig);
+                LOG(LL_FATAL, "epoll_wait: signal %d", g_sig);
                 return(EXIT_CANT_RECOVER);
         }
     } else {
         /* anything else is bad */
-        LOG(LL_FATAL, "select: %s", strerror(errno));
+        LOG(LL_FATAL, "epoll_wait: %s", strerror(errno));
         return(EXIT_CANT_RECOVER);
     }
 }
 
 int
-handle_read_error(int res, worker_context_t* ctxt, sock_context_t* s)
+handle_read_error(int res, sock_context_t* s)
 {
+    request_t      * req;
+
     switch(res) {
         case PROTO_PEER_LOST:
             LOG(LL_INFO, "Socket %d closed from peer, removing"
                          " from worker's set", s->sock);
-            res = close_peer(ctxt, s->sock);
+            res = close_peer(s);
             break;
 
-        case PROTO_INVALID:
-            LOG(LL_DEBUG, "Set reply type to error for %d", s->sock);
-            s->rep_type = REP_ERROR_INVALID_REQ;
-            s->status = SOCK_WRITE;
+        case PROTO_INVALID: case PROTO_INTERNAL_ERROR:
+            LOG(LL_DEBUG, "Set reply type to %s error for %d",
+                (PROTO_INVALID == res) ? "invalid request" : "internal",
+                s->sock);
+            req = s->in;
+            s->in = NULL;
+            req->rep_type = (PROTO_INVALID == res) ?
+                REP_ERROR_INVALID_REQ : REP_ERROR_INTERNAL_ERROR;
+            req->index = BATCH_INDEX_ALL;
+            s->serial = !IS_PIPELINED(req->reqhdr.ver);
+            ++s->num_inflight;
+            queue_reply(s, req);
             res = 1;
             break;
 
@@ -1341,17 +3466,17 @@ handle_read_error(int res, worker_context_t* ctxt, sock_context_t* s)
             break;
     }
 
-    return(res); /* things alright */
+    return(res); /* 0 = closed, 1 = reply pending */
 }
 
 int
-handle_write_error(int res, worker_context_t* ctxt, sock_context_t* s)
+handle_write_error(int res, sock_context_t* s)
 {
     switch(res) {
         case PROTO_PEER_LOST:
             LOG(LL_INFO, "Socket %d closed from peer, removing"
                  " from worker's set", s->sock);
-            res = close_peer(ctxt, s->sock);
+            res = close_peer(s);
             break;
 
         case EXIT_OK: case EXIT_CRASH: case EXIT_CANT_RECOVER:
@@ -1367,47 +3492,50 @@ handle_write_error(int res, worker_context_t* ctxt, sock_context_t* s)
 }
 
 int
-close_peer(worker_context_t *ctxt, int sock)
+close_peer(sock_context_t* s)
 {
-    int       res = 1;
-    array_t * a = ctxt->sock_contexts;
+    request_t* req;
 
-    if(0 != pthread_mutex_lock(&ctxt->mutex)) {
-        LOG(LL_FATAL, "Can't lock thread context mutex");
-        return(EXIT_CANT_RECOVER);
-    }
+    free_requests(s->in);
+    s->in = NULL;
 
-    /* remove from our set and see if we hit 0 socks */
-    array_remove(a, (elem_t)(intptr_t)sock, comp_sock_context);
+    for(req = s->out_head; NULL != req; req = req->next)
+        end_request(s, req, SMRZR_FALSE);
 
-    if(ARR_EMPTY(a)) {
-        LOG(LL_DEBUG, "No more sockets with worker.");
-        ctxt->max_fds = 0;
-        res = 0;
-    } else {
-        ctxt->max_fds = ((sock_context_t*)ARR_LAST(a))->sock + 1;
-    }
+    free_requests(s->out_head);
+    s->out_head = s->out_tail = NULL;
+    s->num_inflight = s->num_computing;
 
-    /* close sock */
-    close(sock);
+    free_requests(s->spare);
+    s->spare = NULL;
 
-    if(0 != pthread_mutex_unlock(&ctxt->mutex)) {
-        LOG(LL_FATAL, "Can't unlock thread context mutex");
-        return(EXIT_CANT_RECOVER);
+    if(0 < s->num_computing) {
+        /* the compute threads return requests to the slot, which may not
+           be reused till then; quiet it meanwhile */
+        s->closing = SMRZR_TRUE;
+        epoll_ctl(g_worker_contexts[s->worker].epoll_fd, EPOLL_CTL_DEL,
+                  s->sock, NULL);
+        shutdown(s->sock, SHUT_RDWR);
+        return(0);
     }
 
-    return(res);
+    release_sock(s);
+
+    return(0);
 }
 
-relation_t
-comp_sock_context(const elem_t ctxt_obj, const elem_t sock) /* word_t*, int */
+void
+release_sock(sock_context_t* s)
 {
-    const sock_context_t* ctxt = (const sock_context_t*)ctxt_obj;
-    const int s = (const int)(const intptr_t)sock;
+    int sock = s->sock;
+
+    COUNTER_SUB(g_worker_contexts[s->worker].num_socks, 1);
 
-    int res = ctxt->sock - s;
+    /* the slot may be reused as soon as the fd is closed */
+    SLOT_SET(s->worker, -1);
+    SLOT_SET(s->sock, -1);
 
-    if(res < 0) return(SMRZR_LT);
-    else if(res > 0) return(SMRZR_GT);
-    else return(SMRZR_EQ);
+    /* closing also takes it out of the worker's epoll set */
+    close(sock);
 }
+
@@ -0,0 +1,57 @@
+/*
+ * summarizerdict.c
+ */
+
+#include "header.h"
+
+/* FUNCTIONS */
+
+static void usage(const char* prog);
+
+int
+main(int argc, char** argv)
+{
+    lang_t     lang;
+    status_t   status;
+    int        opt;
+    literal_t  xml_name = NULL;
+    literal_t  dict_name = NULL;
+
+    while(-1 != (opt = getopt(argc, argv, "i:o:h"))) {
+        switch(opt) {
+            case 'i': xml_name = optarg; break;
+            case 'o': dict_name = optarg; break;
+            case 'h': usage(argv[0]); return(0);
+            default: usage(argv[0]); return(1);
+        }
+    }
+
+    if(NULL == xml_name || NULL == dict_name) {
+        fprintf(stderr, "Both input and output files must be specified\n");
+        usage(argv[0]);
+        return(1);
+    }
+
+    status =
+        init_globals() ||
+
+        lang_init(&lang) ||
+
+        lang_load_xml(xml_name, &lang) ||
+
+        lang_save_dict(&lang, dict_name);
+
+    lang_destroy(&lang);
+
+    return(SMRZR_OK == status ? 0 : 1);
+}
+
+void usage(const char* prog)
+{
+    fprintf(stderr, "Usage: %s -i <dictionary-xml> -o <compiled-dictionary>\n", prog);
+    fprintf(stderr, "Usage: %s -h\n\n", prog);
+    fprintf(stderr, "   dictionary-xml : the language rules, e.g. en.xml\n");
+    fprintf(stderr, "compiled-dictionary : the image to write, e.g. en.dict, used\n");
+    fprintf(stderr, "                      instead of the xml next to it\n");
+    fprintf(stderr, "               -h : print this help\n");
+}
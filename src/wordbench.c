@@ -0,0 +1,306 @@
+/*
+ * wordbench.c
+ */
+
+#include "header.h"
+
+/* MACROS */
+
+#define DOC_DEFAULT_KB      1600
+#define ROOTS_DEFAULT       40000
+#define PASSES_DEFAULT      5
+
+#define NUM_OF(a)  (sizeof(a) / sizeof((a)[0]))
+
+#define MSECS(t1, t2) \
+    (((t2).tv_sec - (t1).tv_sec) * 1000.0 + \
+     ((t2).tv_usec - (t1).tv_usec) / 1000.0)
+
+/* GLOBALS */
+
+static uint64_t s_seed = 88172645463325252ULL;
+
+static literal_t s_common[] = {
+    "the", "of", "to", "and", "a", "in", "is", "was", "for", "on", "that",
+    "by", "with", "as", "at", "from", "have", "been", "were", "said",
+    "health", "officials", "government", "hospital", "police", "people",
+    "cases", "city", "students", "workers", "report", "quarantine"
+};
+
+static literal_t s_prefixes[] = {
+    "", "", "", "pre", "un", "dis", "over", "re"
+};
+
+static literal_t s_suffixes[] = {
+    "", "", "s", "ed", "ing", "ment", "ness", "ism", "ful", "ation", "ies",
+    "ers", "ly", "al"
+};
+
+static literal_t s_others[] = {
+    "Mr.", "Dr.", "Inc.", "Corp.", "Co.", "U.S.", "Jan.", "Feb.", "No.",
+    "e.g.", "etc.", "Beijing", "SARS", "China", "2,422", "37", "16"
+};
+
+/* FUNCTIONS */
+
+static void usage(const char* prog);
+static string_t make_document(size_t doc_sz, size_t num_roots);
+static status_t bench_tables(article_t* article);
+static size_t next_random(size_t below);
+
+size_t
+next_random(size_t below)
+{
+    /* xorshift, so the same document is generated everywhere */
+    s_seed ^= s_seed << 13;
+    s_seed ^= s_seed >> 7;
+    s_seed ^= s_seed << 17;
+
+    return((size_t)(s_seed % below));
+}
+
+int
+main(int argc, char** argv)
+{
+    lang_t          lang;
+    article_t       article;
+    status_t        status;
+    struct timeval  t1, t2;
+    string_t        doc;
+    FILE          * fp;
+    int             opt, i;
+    literal_t       xml_name = DICTIONARY_DIR"/en.xml", out_name = NULL;
+    size_t          doc_sz = DOC_DEFAULT_KB << 10, num_roots = ROOTS_DEFAULT;
+    int             num_passes = PASSES_DEFAULT;
+    double          best = 0, msecs;
+
+    while(-1 != (opt = getopt(argc, argv, "d:o:s:w:n:h"))) {
+        switch(opt) {
+            case 'd': xml_name = optarg; break;
+            case 'o': out_name = optarg; break;
+            case 's': doc_sz = (size_t)atol(optarg) << 10; break;
+            case 'w': num_roots = atol(optarg); break;
+            case 'n': num_passes = atoi(optarg); break;
+            case 'h': usage(argv[0]); return(0);
+            default: usage(argv[0]); return(1);
+        }
+    }
+
+    if(0 == doc_sz || 0 == num_roots || 0 >= num_passes) {
+        usage(argv[0]);
+        return(1);
+    }
+
+    if(NULL == (doc = make_document(doc_sz, num_roots)))
+        return(1);
+
+    /* kept to time the summarizer itself, e.g. built with -DSMRZRPROF */
+    if(NULL != out_name) {
+        if(NULL == (fp = fopen(out_name, "w")) ||
+           1 != fwrite(doc, strlen(doc), 1, fp) || 0 != fclose(fp))
+        {
+            perror("Error in writing document: ");
+            free(doc);
+            return(1);
+        }
+        free(doc);
+        return(0);
+    }
+
+    status =
+        init_globals() ||
+
+        lang_init(&lang) ||
+
+        parse_lang_xml(xml_name, &lang) ||
+
+        article_init(&article, SMRZR_FALSE);
+
+    for(i = 0; SMRZR_OK == status && i < num_passes; ++i) {
+
+        article_reset(&article);
+
+        gettimeofday(&t1, NULL);
+        status = parse_article_buffer(doc, strlen(doc), &lang, &article);
+        gettimeofday(&t2, NULL);
+
+        msecs = MSECS(t1, t2);
+        if(0 == i || msecs < best) best = msecs;
+    }
+
+    if(SMRZR_OK == status) {
+        fprintf(stdout, "document: %lu bytes, %lu tokens, %lu stems\n",
+                strlen(doc), ARR_SZ(article.tokens), ARR_SZ(article.stems));
+        fprintf(stdout, "article parsing: %.1f ms (best of %d)\n",
+                best, num_passes);
+
+        status = bench_tables(&article);
+    }
+
+    article_destroy(&article);
+
+    lang_destroy(&lang);
+
+    free(doc);
+
+    return(SMRZR_OK == status ? 0 : 1);
+}
+
+void usage(const char* prog)
+{
+    fprintf(stderr, "Usage: %s [-d <dictionary-xml>] [-s <size>] [-w <roots>] [-n <passes>] [-o <file>]\n", prog);
+    fprintf(stderr, "Usage: %s -h\n\n", prog);
+    fprintf(stderr, "dictionary-xml : the language rules [%s]\n",
+            DICTIONARY_DIR"/en.xml");
+    fprintf(stderr, "          size : of the generated report in KB [%d]\n",
+            DOC_DEFAULT_KB);
+    fprintf(stderr, "         roots : distinct made-up words it is built from,\n"
+                    "                 each with several prefixes and suffixes [%d]\n",
+            ROOTS_DEFAULT);
+    fprintf(stderr, "        passes : parses timed, the best is reported [%d]\n",
+            PASSES_DEFAULT);
+    fprintf(stderr, "          file : only write the report there, to be given\n"
+                    "                 to the summarizer\n");
+    fprintf(stderr, "            -h : print this help\n");
+}
+
+string_t
+make_document(size_t doc_sz, size_t num_roots)
+{
+    string_t    doc, roots, p, w;
+    size_t      len = 0, i, j, root_len, num_words = 0, num_sentences = 0;
+    size_t      sentence_len = 0, para_len = 0;
+
+    /* made-up roots, then words from them with affixes like a long report
+       has, among common words, abbreviations and numbers */
+    if(NULL == (roots = (string_t)malloc(num_roots * 8)) ||
+       NULL == (doc = (string_t)malloc(doc_sz + 64)))
+    {
+        free(roots);
+        return(NULL);
+    }
+
+    for(i = 0; i < num_roots; ++i) {
+        root_len = 3 + next_random(5);
+        for(j = 0; j < root_len; ++j) roots[i * 8 + j] = 'a' + next_random(26);
+        roots[i * 8 + root_len] = 0;
+    }
+
+    while(len < doc_sz) {
+
+        if(0 == sentence_len) sentence_len = 8 + next_random(18);
+
+        p = doc + len;
+
+        switch(next_random(10)) {
+            case 0: case 1: case 2: case 3:
+                len += sprintf(p, "%s", s_common[next_random(NUM_OF(s_common))]);
+                break;
+            case 4:
+                len += sprintf(p, "%s", s_others[next_random(NUM_OF(s_others))]);
+                break;
+            default:
+                w = roots + 8 * next_random(num_roots);
+                len += sprintf(p, "%s%s%s",
+                               s_prefixes[next_random(NUM_OF(s_prefixes))], w,
+                               s_suffixes[next_random(NUM_OF(s_suffixes))]);
+                break;
+        }
+
+        if(0 == num_words++) *p = toupper(*p);
+
+        if(num_words < sentence_len) {
+            doc[len++] = (0 == next_random(12)) ? ',' : ' ';
+            if(',' == doc[len - 1]) doc[len++] = ' ';
+            continue;
+        }
+
+        /* end of a sentence, and now and then of a paragraph */
+        doc[len++] = ".?!"[next_random(8) / 6];
+        num_words = 0;
+        sentence_len = 0;
+        ++num_sentences;
+
+        if(0 == para_len) para_len = 3 + next_random(6);
+
+        if(num_sentences == para_len) {
+            doc[len++] = '\n';
+            doc[len++] = '\n';
+            num_sentences = para_len = 0;
+        } else {
+            doc[len++] = ' ';
+        }
+    }
+
+    doc[len] = 0;
+
+    free(roots);
+
+    return(doc);
+}
+
+status_t
+bench_tables(article_t* article)
+{
+    array_t       * stems, * sorted;
+    hash_t        * index;
+    string_t      * all, * entry;
+    uint32_t      * token;
+    struct timeval  t1, t2, t3;
+    bool_t          is_new;
+    status_t        status = SMRZR_OK;
+
+    /* the parsed stems counted again, once through a hash index and once
+       kept sorted by insertion, as the word table used to be */
+    all = (string_t*)ARR_AT(article->stems, 0);
+
+    if(NULL == (stems = array_new(SMRZR_TRUE, sizeof(string_t),
+                                  ARRAY_DEFAULT_SZ, NULL)) ||
+       NULL == (sorted = array_new(SMRZR_TRUE, sizeof(string_t),
+                                   ARRAY_DEFAULT_SZ, NULL)) ||
+       NULL == (index = hash_new(HASH_DEFAULT_SLOTS, NULL)))
+        ERROR_RET;
+
+    gettimeofday(&t1, NULL);
+
+    for(token = (uint32_t*)ARR_FIRST(article->tokens);
+        SMRZR_OK == status && !ARR_END(article->tokens);
+        token = (uint32_t*)ARR_NEXT(article->tokens))
+    {
+        if(NULL == (entry = hash_search_or_alloc(&index, &stems, all[*token],
+                                                 hash_string(all[*token]),
+                                                 comp_stems, &is_new)))
+            status = SMRZR_ERROR;
+        else if(SMRZR_TRUE == is_new)
+            *entry = all[*token];
+    }
+
+    gettimeofday(&t2, NULL);
+
+    for(token = (uint32_t*)ARR_FIRST(article->tokens);
+        SMRZR_OK == status && !ARR_END(article->tokens);
+        token = (uint32_t*)ARR_NEXT(article->tokens))
+    {
+        if(NULL == (entry = array_search_or_alloc(&sorted, all[*token],
+                                                  comp_stems, &is_new)))
+            status = SMRZR_ERROR;
+        else if(SMRZR_TRUE == is_new)
+            *entry = all[*token];
+    }
+
+    gettimeofday(&t3, NULL);
+
+    if(SMRZR_OK == status && ARR_SZ(stems) != ARR_SZ(sorted))
+        status = SMRZR_ERROR;
+
+    if(SMRZR_OK == status) {
+        fprintf(stdout, "word table, hash index: %.1f ms\n", MSECS(t1, t2));
+        fprintf(stdout, "word table, sorted insertion: %.1f ms\n", MSECS(t2, t3));
+    }
+
+    array_free(stems);
+    array_free(sorted);
+    hash_free(index);
+
+    return(status);
+}